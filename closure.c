@@ -0,0 +1,379 @@
+/*
+ *  Dependency closure of a binary as resolved by ld.so
+ *  Copyright © 2007-2011 Andrew Savchenko
+ *
+ *  This file is part of symlookup.
+ *
+ *  symlookup is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 3 as
+ *  published by the Free Software Foundation
+ *
+ *  symlookup is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License version 3 for more details.
+ *
+ *  You should have received a copy of the GNU General Public License version 3
+ *  along with symlookup. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
+#include <error.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <gelf.h>
+#include <sys/stat.h>
+
+#include "symlookup.h"
+#include "safemem.h"
+#include "parser.h"
+#include "ldcache.h"
+#include "closure.h"
+
+/* Libraries are resolved the way ld.so(8) does: the binary goes first,
+ * LD_PRELOAD ones follow, then DT_NEEDED entries of all loaded objects
+ * breadth first. A name with a slash is used as is, others are searched
+ *   in DT_RPATH of the needing object and of its loaders up to the
+ *      binary, unless the needing object has DT_RUNPATH;
+ *   in $LD_LIBRARY_PATH;
+ *   in DT_RUNPATH of the needing object;
+ *   in ld.so.cache and default directories, unless the needing object
+ *      is linked with -z nodeflib.
+ * Objects of different class or machine than the binary are skipped,
+ * ones loaded already (by name, soname or device and inode) are reused.
+ * The scan order makes the first definition of a symbol the one bound. */
+
+/* loaded object */
+struct obj_t {
+    char *path;             //path it is opened by
+    char *name;             //name it is loaded for
+    char *soname;           //DT_SONAME, if any
+    char *rpath;            //DT_RPATH, if any
+    char *runpath;          //DT_RUNPATH, if any
+    char *origin;           //value of $ORIGIN
+    unsigned int nodeflib;  //skip cache and default directories
+    int loader;             //object which needs it, -1 for the binary
+    dev_t dev;
+    ino_t ino;
+    struct str_t needed;    //DT_NEEDED entries
+};
+
+extern struct str_t sp; //all search pathes (string array)
+
+static struct obj_t *obj = NULL;    //loaded objects in load order
+static unsigned int obj_count = 0;
+static int elf_class;               //class of the binary
+static GElf_Half elf_machine;       //machine of the binary
+static struct str_t cache_soname = {0, NULL},   //ld.so.cache entries
+                    cache_path   = {0, NULL},
+                    sys_dirs     = {0, NULL};   //default directories
+
+/* free memory of object <o> */
+static void free_obj(struct obj_t* const o)
+{
+    free(o->path);
+    free(o->name);
+    free(o->soname);
+    free(o->rpath);
+    free(o->runpath);
+    free(o->origin);
+    free_str(&o->needed);
+}
+
+/* read dynamic section of <elf> to <o> */
+static void read_dynamic(Elf* const elf, struct obj_t* const o)
+{
+    Elf_Scn *scn = NULL;
+    GElf_Shdr shdr;
+
+    while ((scn = elf_nextscn(elf, scn)))
+        if (gelf_getshdr(scn, &shdr) && shdr.sh_type == SHT_DYNAMIC && shdr.sh_entsize) {
+            Elf_Data *const data = elf_getdata(scn, NULL);
+            const size_t count = shdr.sh_size / shdr.sh_entsize;
+            GElf_Dyn dyn;
+            const char *str;
+
+            for (size_t i=0; data && i < count && gelf_getdyn(data, i, &dyn) &&
+                             dyn.d_tag != DT_NULL; i++)
+                switch (dyn.d_tag) {
+                    case DT_NEEDED:
+                        if ((str = elf_strptr(elf, shdr.sh_link, dyn.d_un.d_val)))
+                            grow_str(&o->needed, str);
+                        break;
+                    case DT_SONAME:
+                    case DT_RPATH:
+                    case DT_RUNPATH:
+                        if (!(str = elf_strptr(elf, shdr.sh_link, dyn.d_un.d_val)))
+                            break;
+                        if (dyn.d_tag == DT_SONAME)
+                            o->soname = alloc_str(str);
+                        else if (dyn.d_tag == DT_RPATH)
+                            o->rpath = alloc_str(str);
+                        else
+                            o->runpath = alloc_str(str);
+                        break;
+                    case DT_FLAGS_1:
+                        if (dyn.d_un.d_val & DF_1_NODEFLIB)
+                            o->nodeflib = 1;
+                        break;
+                }
+            return;
+        }
+}
+
+/* Read ELF object <path> to <o>, the binary is read if <root> is set.
+   1 == ok
+   0 == file can't be read or can't be loaded by the binary */
+static int read_obj(const char* const path, struct obj_t* const o, const int root)
+{
+    struct stat st;
+    GElf_Ehdr ehdr;
+    Elf *elf;
+    int fd, ret = 0;
+
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return 0;
+    if (!fstat(fd, &st) && S_ISREG(st.st_mode) &&
+        (elf = elf_begin(fd, ELF_C_READ, NULL))) {
+        if (elf_kind(elf) == ELF_K_ELF && gelf_getehdr(elf, &ehdr) &&
+            (ehdr.e_type == ET_DYN || (root && ehdr.e_type == ET_EXEC)) &&
+            (root || (gelf_getclass(elf) == elf_class && ehdr.e_machine == elf_machine))) {
+            memset(o, 0, sizeof(*o));
+            if (root) {
+                elf_class = gelf_getclass(elf);
+                elf_machine = ehdr.e_machine;
+            }
+            o->dev = st.st_dev;
+            o->ino = st.st_ino;
+            read_dynamic(elf, o);
+            ret = 1;
+        }
+        elf_end(elf);
+    }
+    close(fd);
+    return ret;
+}
+
+/* directory of <path>, allocated */
+static char* dir_of(const char* const path)
+{
+    const char *const p = strrchr(path, '/');
+    char *dir;
+
+    if (!p)
+        return alloc_str(".");
+    dir = xmalloc(p - path + 2);
+    // the root directory keeps its slash
+    memcpy(dir, path, (p == path) ? 1 : p - path);
+    dir[(p == path) ? 1 : p - path] = '\0';
+    return dir;
+}
+
+/* Expand $ORIGIN and ${ORIGIN} in <str> of <len> bytes to <origin>.
+   Allocated result is returned, NULL if <str> has other tokens,
+   such as $LIB or $PLATFORM, which depend on ld.so build. */
+static char* expand(const char* const str, const size_t len, const char* const origin)
+{
+    char *res = xmalloc(len + 1), *p;
+    size_t size = len + 1, n = 0;
+
+    for (size_t i=0; i < len; i++) {
+        size_t skip = 0;
+        if (str[i] == '$') {
+            if (!strncmp(str + i + 1, "ORIGIN", 6))
+                skip = 7;
+            else if (!strncmp(str + i + 1, "{ORIGIN}", 8))
+                skip = 9;
+            // "$ORIGINAL" is a different token
+            if (!skip || !origin || (skip == 7 && i + 7 < len &&
+                (isalnum((unsigned char)str[i+7]) || str[i+7] == '_'))) {
+                free(res);
+                return NULL;
+            }
+        }
+        if (skip) {
+            const size_t olen = strlen(origin);
+            size += olen;
+            res = xrealloc(res, size);
+            memcpy(res + n, origin, olen);
+            n += olen;
+            i += skip - 1;
+        }
+        else
+            res[n++] = str[i];
+    }
+    res[n] = '\0';
+    // ld.so drops trailing slashes of directories
+    for (p = res + n - 1; p > res && *p == '/'; p--)
+        *p = '\0';
+    return res;
+}
+
+/* Try to load library <name> needed by object <loader> from <path>.
+   >= 0 == index of the object, possibly loaded before
+   -1   == path is unsuitable, search goes on */
+static int try_path(const char* const path, const char* const name, const int loader)
+{
+    struct obj_t o;
+
+    if (!read_obj(path, &o, 0))
+        return -1;
+    for (unsigned int i=0; i < obj_count; i++)
+        if (obj[i].dev == o.dev && obj[i].ino == o.ino) {
+            free_obj(&o);
+            return i;
+        }
+    o.path = alloc_str(path);
+    o.name = alloc_str(name);
+    o.origin = dir_of(path);
+    o.loader = loader;
+    obj = xrealloc(obj, sizeof(struct obj_t) * (obj_count + 1));
+    obj[obj_count] = o;
+    return obj_count++;
+}
+
+/* search library <name> needed by object <loader> in directories
+   of <list> separated by any of <delim>, $ORIGIN stands for <origin>;
+   index of the object is returned, -1 if not found */
+static int search_list(const char* const list, const char* const delim,
+                       const char* const origin, const char* const name,
+                       const int loader)
+{
+    const char *p = list;
+    int idx = -1;
+
+    do {
+        const size_t len = strcspn(p, delim);
+        char *const dir = expand(p, len, origin);
+
+        if (dir) {
+            // empty entry stands for current directory
+            char *const path = xmalloc(strlen(dir) + strlen(name) + 3);
+            sprintf(path, "%s/%s", (*dir) ? dir : ".", name);
+            idx = try_path(path, name, loader);
+            free(path);
+            free(dir);
+        }
+        else if (opt.verb >= V_VERBOSE)
+            error(0, 0, "warning: search path entry '%.*s' is skipped", (int)len, p);
+        p += len;
+    } while (idx < 0 && *p++);
+    return idx;
+}
+
+/* resolve library <name> needed by object <loader>;
+   index of the object is returned, -1 if not found */
+static int resolve(const char* const name, const int loader)
+{
+    const char *env;
+    int idx;
+
+    // already loaded objects are matched by name
+    for (unsigned int i=0; i < obj_count; i++)
+        if (!strcmp(name, obj[i].name) || !strcmp(name, obj[i].path) ||
+            (obj[i].soname && !strcmp(name, obj[i].soname)))
+            return i;
+
+    if (strchr(name, '/')) {
+        char *const path = expand(name, strlen(name), obj[loader].origin);
+        idx = (path) ? try_path(path, name, loader) : -1;
+        free(path);
+        return idx;
+    }
+
+    if (!obj[loader].runpath)
+        for (int i = loader; i >= 0; i = obj[i].loader)
+            if (obj[i].rpath && !obj[i].runpath &&
+                (idx = search_list(obj[i].rpath, ":", obj[i].origin, name, loader)) >= 0)
+                return idx;
+    if ((env = getenv("LD_LIBRARY_PATH")) && *env &&
+        (idx = search_list(env, ":;", obj[0].origin, name, loader)) >= 0)
+        return idx;
+    if (obj[loader].runpath &&
+        (idx = search_list(obj[loader].runpath, ":", obj[loader].origin, name, loader)) >= 0)
+        return idx;
+    if (obj[loader].nodeflib)
+        return -1;
+
+    for (unsigned int i=0; i < cache_soname.size; i++)
+        if (!strcmp(name, cache_soname.str[i]) &&
+            (idx = try_path(cache_path.str[i], name, loader)) >= 0)
+            return idx;
+    for (unsigned int i=0; i < sys_dirs.size; i++)
+        if ((idx = search_list(sys_dirs.str[i], "", NULL, name, loader)) >= 0)
+            return idx;
+    return -1;
+}
+
+void closure_load()
+{
+    char *real;
+    const char *env;
+
+    /* libelf is used before main() initializes it */
+    if (elf_version(EV_CURRENT) == EV_NONE)
+        error(ERR_ELF, elf_errno(), "fatal: cannot initialize libelf");
+
+    obj = xmalloc(sizeof(struct obj_t));
+    if (!read_obj(opt.for_binary, obj, 1)) {
+        if (access(opt.for_binary, R_OK))
+            error(ERR_IO, errno, "i/o error: can't read binary %s", opt.for_binary);
+        error(ERR_ELF, 0, "%s is not an ELF executable or shared object", opt.for_binary);
+    }
+    obj->path = alloc_str(opt.for_binary);
+    obj->name = alloc_str(opt.for_binary);
+    // $ORIGIN of the binary has symbolic links resolved, unlike libraries
+    if ((real = realpath(opt.for_binary, NULL))) {
+        obj->origin = dir_of(real);
+        free(real);
+    }
+    else
+        obj->origin = dir_of(opt.for_binary);
+    obj->loader = -1;
+    obj_count = 1;
+
+    // missing cache is not an error for ld.so
+    if (ldcache_read(LDCACHE_DEFAULT, &cache_soname, &cache_path) && opt.verb)
+        error(0, errno, "warning: can't use ld cache " LDCACHE_DEFAULT);
+    if (elf_class == ELFCLASS64) {
+        grow_str(&sys_dirs, "/lib64");
+        grow_str(&sys_dirs, "/usr/lib64");
+    }
+    grow_str(&sys_dirs, "/lib");
+    grow_str(&sys_dirs, "/usr/lib");
+    // libraries missing in stale cache are likely there
+    parse_ld_so_conf(LD_SO_CONF, &sys_dirs);
+
+    /* preloaded libraries are treated as needed by the binary */
+    if ((env = getenv("LD_PRELOAD"))) {
+        char *const list = alloc_str(env), *tok_buf, *name;
+        for (name = strtok_r(list, " :", &tok_buf); name; name = strtok_r(NULL, " :", &tok_buf))
+            if (resolve(name, 0) < 0 && opt.verb)
+                error(0, 0, "warning: preloaded library %s is not found", name);
+        free(list);
+    }
+
+    /* breadth first walk of dependencies, obj grows meanwhile */
+    for (unsigned int i=0; i < obj_count; i++)
+        for (unsigned int j=0; j < obj[i].needed.size; j++)
+            if (resolve(obj[i].needed.str[j], i) < 0 && opt.verb)
+                error(0, 0, "warning: library %s needed by %s is not found",
+                      obj[i].needed.str[j], obj[i].path);
+
+    for (unsigned int i=0; i < obj_count; i++) {
+        grow_str(&sp, obj[i].path);
+        free_obj(&obj[i]);
+    }
+    free(obj);
+    obj = NULL;
+    free_str(&cache_soname);
+    free_str(&cache_path);
+    free_str(&sys_dirs);
+
+    if (opt.verb >= V_VERBOSE)
+        printf("--> %u objects are loaded for %s\n", obj_count, opt.for_binary);
+}
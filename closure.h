@@ -0,0 +1,27 @@
+/*
+ *  Dependency closure of a binary as resolved by ld.so
+ *  Copyright © 2007-2011 Andrew Savchenko
+ *
+ *  This file is part of symlookup.
+ *
+ *  symlookup is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 3 as
+ *  published by the Free Software Foundation
+ *
+ *  symlookup is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License version 3 for more details.
+ *
+ *  You should have received a copy of the GNU General Public License version 3
+ *  along with symlookup. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SL_CLOSURE_H
+#define SL_CLOSURE_H
+
+/* add opt.for_binary and all libraries it depends on to the search path
+   array in the order ld.so(8) loads them */
+void closure_load();
+
+#endif /* SL_CLOSURE_H */
@@ -0,0 +1,1518 @@
+/*
+ *  Persistent symbol index
+ *  Copyright © 2007-2011 Andrew Savchenko
+ *
+ *  This file is part of symlookup.
+ *
+ *  symlookup is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 3 as
+ *  published by the Free Software Foundation
+ *
+ *  symlookup is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License version 3 for more details.
+ *
+ *  You should have received a copy of the GNU General Public License version 3
+ *  along with symlookup. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <error.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <fts.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "symlookup.h"
+#include "safemem.h"
+#include "scanelf.h"
+#include "mregex.h"
+#include "index.h"
+
+/* Index file is built by a normal scan which collects all defined and
+ * undefined symbols instead of requested ones. It is mapped as a whole by
+ * queries, all numbers are in host byte order:
+ *   header
+ *   file table      path and status of each scanned file, sorted by path
+ *   block table     offsets of name blocks in the dictionary
+ *   member table    offsets of archive member names, sorted by name
+ *   directory table status of each walked directory, sorted by path
+ *   entry table     regular files and subdirectories of each directory
+ *   hash tables     displacements of buckets and name numbers of slots
+ *   dictionary      distinct symbol names in order with their postings
+ *   string pool     NUL terminated strings, the empty one first
+ * The dictionary is front coded in blocks of INDEX_BLOCK names: each
+ * name is stored as the length of prefix shared with the previous one
+ * (0 for the first name of a block), the length of the rest and the
+ * rest itself, followed by the number of its postings and postings:
+ * file number (the difference from the previous one), member number + 1
+ * (0 == none) shifted left with INDEX_UNDEF flag and st_info byte.
+ * All numbers there are LEB128 encoded. Postings are sorted by file,
+ * so undefined references form an inverted list of consumers as well.
+ * Exact names are found via perfect hash (hash and displace)
+ * without any search; other queries decode the dictionary in order,
+ * so each distinct name is matched once.
+ * An existing index is refreshed: files with the same device, inode,
+ * size and modification time as recorded keep their symbols and only
+ * new or changed files are scanned, the same way as skip cache works.
+ * Directories with the same device, inode and modification time are
+ * not even read: their recorded entries are used, subdirectories are
+ * stat'ed and files are kept by path. Files are expected to be
+ * replaced rather than rewritten in place, as package managers do. */
+
+#define INDEX_MAGIC "symlookup idx 6\n"
+#define INDEX_ORDER 0x01020304U
+#define INDEX_BLOCK 16          //names per dictionary block
+#define INDEX_UNDEF 1           //posting is an undefined reference
+
+struct index_hdr_t {
+    char magic[sizeof(INDEX_MAGIC) - 1];
+    uint32_t order;             //INDEX_ORDER in host byte order
+    uint32_t block;             //INDEX_BLOCK
+    uint64_t files;             //number of files
+    uint64_t file_off;          //offset of file table
+    uint64_t syms;              //number of symbols (postings)
+    uint64_t names;             //number of distinct names
+    uint64_t block_off;         //offset of block table
+    uint64_t dict_off;          //offset of dictionary
+    uint64_t dict_size;         //size of dictionary
+    uint64_t members;           //number of archive member names
+    uint64_t member_off;        //offset of member table
+    uint64_t seed;              //seed of perfect hash
+    uint64_t buckets;           //number of hash buckets
+    uint64_t disp_off;          //offset of displacements, one per bucket
+    uint64_t slots;             //number of hash slots
+    uint64_t slot_off;          //offset of name numbers of slots, names for empty ones
+    uint64_t dirs;              //number of directories
+    uint64_t dir_off;           //offset of directory table
+    uint64_t entries;           //number of directory entries
+    uint64_t entry_off;         //offset of entry table
+    uint64_t str_off;           //offset of string pool
+    uint64_t str_size;          //size of string pool
+};
+
+#define INDEX_AR 1               //file is an ar archive
+
+struct index_file_t {
+    uint64_t path;              //offset of path in string pool
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime;
+    int64_t mtime_nsec;
+    uint32_t flags;             //INDEX_AR
+    uint32_t reserved;
+};
+
+#define INDEX_RACY 1            //directory was modified during the walk
+
+struct index_dir_t {
+    uint64_t path;              //offset of path in string pool
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime;
+    int64_t mtime_nsec;
+    uint64_t entry;             //index of the first entry
+    uint32_t entries;           //number of entries
+    uint32_t flags;             //INDEX_RACY
+};
+
+struct index_entry_t {
+    uint64_t name;              //offset of name in string pool
+    uint32_t kind;              //INDEX_ENTRY_*
+    uint32_t reserved;
+};
+
+/* mapped index */
+struct index_map_t {
+    const char *path;
+    void *image;
+    size_t size;
+    const struct index_file_t *file;
+    const uint64_t *block;
+    const unsigned char *dict;
+    const uint64_t *member;
+    const uint32_t *disp;
+    const uint32_t *slot;
+    const struct index_dir_t *dir;
+    const struct index_entry_t *entry;
+    const char *str;
+    uint64_t files, syms, names, dict_size, members, seed, buckets, slots;
+    uint64_t dirs, entries, str_size;
+};
+
+/* check whether table at <off> of <count> elements of <size> bytes
+   lies within index of <total> bytes and is aligned to its elements */
+static inline int table_ok(const uint64_t off, const uint64_t count, const size_t size,
+                           const size_t total)
+{
+    return off <= total && count <= (total - off) / size &&
+           !(off % ((size < sizeof(uint64_t)) ? size : sizeof(uint64_t)));
+}
+
+/* Map index <path> to <map>.
+   Returns NULL on success or error message with a place for the path,
+   <err> is set to errno value or 0. */
+static const char* index_map(const char* const path, struct index_map_t* const map,
+                             int* const err)
+{
+    const struct index_hdr_t *hdr;
+    struct stat st;
+    int fd;
+
+    *err = 0;
+    if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st)) {
+        *err = errno;
+        if (fd != -1)
+            close(fd);
+        return "i/o error: can't read index %s";
+    }
+    if ((size_t)st.st_size < sizeof(struct index_hdr_t)) {
+        close(fd);
+        return "%s is not a symlookup index";
+    }
+    map->image = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    *err = errno;
+    close(fd);
+    if (map->image == MAP_FAILED)
+        return "i/o error: can't map index %s";
+    *err = 0;
+    map->size = st.st_size;
+    map->path = path;
+
+    /* all tables must lie within the file */
+    hdr = map->image;
+    if (memcmp(hdr->magic, INDEX_MAGIC, sizeof(hdr->magic))) {
+        munmap(map->image, map->size);
+        return "%s is not a symlookup index of this version";
+    }
+    if (hdr->order != INDEX_ORDER) {
+        munmap(map->image, map->size);
+        return "index %s is built on a host of different byte order";
+    }
+    if (hdr->block != INDEX_BLOCK ||
+        !table_ok(hdr->file_off, hdr->files, sizeof(struct index_file_t), map->size) ||
+        !table_ok(hdr->block_off, (hdr->names + INDEX_BLOCK - 1) / INDEX_BLOCK,
+                  sizeof(uint64_t), map->size) ||
+        !table_ok(hdr->dict_off, hdr->dict_size, 1, map->size) ||
+        !table_ok(hdr->member_off, hdr->members, sizeof(uint64_t), map->size) ||
+        !table_ok(hdr->disp_off, hdr->buckets, sizeof(uint32_t), map->size) ||
+        !table_ok(hdr->slot_off, hdr->slots, sizeof(uint32_t), map->size) ||
+        (hdr->names && (!hdr->buckets || hdr->slots < hdr->names)) ||
+        hdr->names > UINT32_MAX ||
+        !table_ok(hdr->dir_off, hdr->dirs, sizeof(struct index_dir_t), map->size) ||
+        !table_ok(hdr->entry_off, hdr->entries, sizeof(struct index_entry_t), map->size) ||
+        !table_ok(hdr->str_off, hdr->str_size, 1, map->size) || !hdr->str_size ||
+        ((const char*)map->image)[hdr->str_off + hdr->str_size - 1] != '\0') {
+        munmap(map->image, map->size);
+        return "index %s is broken";
+    }
+
+#define TABLE(type, off) ((const type*)((const char*)map->image + (off)))
+    map->file = TABLE(struct index_file_t, hdr->file_off);
+    map->block = TABLE(uint64_t, hdr->block_off);
+    map->dict = TABLE(unsigned char, hdr->dict_off);
+    map->member = TABLE(uint64_t, hdr->member_off);
+    map->disp = TABLE(uint32_t, hdr->disp_off);
+    map->slot = TABLE(uint32_t, hdr->slot_off);
+    map->dir = TABLE(struct index_dir_t, hdr->dir_off);
+    map->entry = TABLE(struct index_entry_t, hdr->entry_off);
+    map->str = TABLE(char, hdr->str_off);
+#undef TABLE
+    map->files = hdr->files;
+    map->syms = hdr->syms;
+    map->names = hdr->names;
+    map->dict_size = hdr->dict_size;
+    map->members = hdr->members;
+    map->seed = hdr->seed;
+    map->buckets = hdr->buckets;
+    map->slots = hdr->slots;
+    map->dirs = hdr->dirs;
+    map->entries = hdr->entries;
+    map->str_size = hdr->str_size;
+    return NULL;
+}
+
+/* string at offset <off> of the pool of <map>, the pool is terminated
+   by '\0', so broken offsets yield an empty string only */
+static inline const char* index_str(const struct index_map_t* const map, const uint64_t off)
+{
+    return map->str + ((off < map->str_size) ? off : 0);
+}
+
+/* make file table record of file <st> */
+static inline void make_key(const struct stat* const st, const unsigned int ar,
+                            struct index_file_t* const key)
+{
+    memset(key, 0, sizeof(*key));
+    if (st) {
+        key->dev = st->st_dev;
+        key->ino = st->st_ino;
+        key->size = st->st_size;
+        key->mtime = st->st_mtim.tv_sec;
+        key->mtime_nsec = st->st_mtim.tv_nsec;
+    }
+    key->flags = (ar) ? INDEX_AR : 0;
+}
+
+/* comparison function for file statuses, paths and flags are ignored */
+static int compare_key(const struct index_file_t* const x, const struct index_file_t* const y)
+{
+    if (x->dev != y->dev)
+        return (x->dev < y->dev) ? -1 : 1;
+    if (x->ino != y->ino)
+        return (x->ino < y->ino) ? -1 : 1;
+    if (x->size != y->size)
+        return (x->size < y->size) ? -1 : 1;
+    if (x->mtime != y->mtime)
+        return (x->mtime < y->mtime) ? -1 : 1;
+    if (x->mtime_nsec != y->mtime_nsec)
+        return (x->mtime_nsec < y->mtime_nsec) ? -1 : 1;
+    return 0;
+}
+
+/* hash of symbol <name> for perfect hash of <seed>: FNV-1a finished
+   by splitmix64 mixer, so both halves are usable */
+static inline uint64_t name_hash(const char* const name, const uint64_t seed)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+
+    for (const unsigned char *p = (const unsigned char*)name; *p; p++)
+        h = (h ^ *p) * 0x100000001b3ULL;
+    h += seed * 0x9e3779b97f4a7c15ULL;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+/* Perfect hash: names are distributed to <buckets> by the high half of
+   their hash; each bucket has displacement chosen to rehash all its
+   names to free slots */
+static inline uint64_t hash_bucket(const uint64_t h, const uint64_t buckets)
+{
+    return (h >> 32) % buckets;
+}
+
+static inline uint64_t hash_slot(uint64_t h, const uint64_t disp, const uint64_t slots)
+{
+    h ^= (disp + 1) * 0x9e3779b97f4a7c15ULL;
+    h = (h ^ (h >> 29)) * 0xbf58476d1ce4e5b9ULL;
+    return (h ^ (h >> 32)) % slots;
+}
+
+/* sequential reader of the dictionary */
+struct cursor_t {
+    const struct index_map_t *map;
+    const unsigned char *p;     //next byte
+    const unsigned char *end;
+    uint64_t k;                 //number of the current name
+    char *name;                 //current name
+    size_t len, alloc;
+    uint64_t left;              //postings of the current name not read yet
+    uint64_t file;              //file of the last posting
+};
+
+/* dictionary of <c> doesn't match its description */
+static void broken(const struct cursor_t* const c)
+{
+    error(ERR_IO, 0, "index %s is broken", c->map->path);
+}
+
+/* read LEB128 number */
+static inline uint64_t get_num(struct cursor_t* const c)
+{
+    uint64_t num = 0;
+
+    for (unsigned int shift = 0; c->p < c->end && shift < 64; shift += 7) {
+        const unsigned char byte = *c->p++;
+        num |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return num;
+    }
+    broken(c);
+    return 0;
+}
+
+/* read the name at the cursor, it follows the current one */
+static void read_name(struct cursor_t* const c)
+{
+    const uint64_t prefix = get_num(c), suffix = get_num(c);
+
+    if (prefix > c->len || suffix > (uint64_t)(c->end - c->p))
+        broken(c);
+    if (prefix + suffix + 1 > c->alloc) {
+        c->alloc = (prefix + suffix + 1) * 2;
+        c->name = xrealloc(c->name, c->alloc);
+    }
+    memcpy(c->name + prefix, c->p, suffix);
+    c->p += suffix;
+    c->len = prefix + suffix;
+    c->name[c->len] = '\0';
+    c->left = get_num(c);
+    c->file = 0;
+}
+
+/* decoded posting */
+struct posting_t {
+    uint64_t file;
+    uint64_t member;            //member number + 1, 0 == none
+    unsigned char info;
+    unsigned char undef;        //undefined reference
+};
+
+/* read the next posting of the current name to <p>,
+   0 is returned if there are no more postings */
+static int get_posting(struct cursor_t* const c, struct posting_t* const p)
+{
+    uint64_t member;
+
+    if (!c->left)
+        return 0;
+    c->left--;
+    c->file += get_num(c);
+    member = get_num(c);
+    p->member = member >> 1;
+    p->undef = member & INDEX_UNDEF;
+    if (c->p == c->end || c->file >= c->map->files || p->member > c->map->members)
+        broken(c);
+    p->info = *c->p++;
+    p->file = c->file;
+    return 1;
+}
+
+/* set cursor <c> to name number <k> of <map> */
+static void seek_name(struct cursor_t* const c, const struct index_map_t* const map,
+                      const uint64_t k)
+{
+    const uint64_t off = map->block[k / INDEX_BLOCK];
+
+    c->map = map;
+    c->end = map->dict + map->dict_size;
+    if (off > map->dict_size)
+        broken(c);
+    c->p = map->dict + off;
+    c->len = 0;
+    c->left = 0;
+    for (c->k = k - k % INDEX_BLOCK; ; c->k++) {
+        read_name(c);
+        if (c->k == k)
+            break;
+        while (c->left) {
+            struct posting_t p;
+            get_posting(c, &p);
+        }
+    }
+}
+
+/* move cursor <c> to the next name, 0 is returned at the end */
+static int next_name(struct cursor_t* const c)
+{
+    struct posting_t p;
+
+    while (get_posting(c, &p));
+    if (++c->k >= c->map->names)
+        return 0;
+    if (!(c->k % INDEX_BLOCK))
+        c->len = 0;
+    read_name(c);
+    return 1;
+}
+
+/********************************************************************
+ *                            BUILDING                              *
+ ********************************************************************/
+
+/* symbol collected by a scanner thread */
+struct rec_t {
+    size_t name;                //offset of name in builder pool
+    unsigned int file;          //file number
+    unsigned int member;        //builder member number + 1, 0 == none
+    unsigned char info;
+    unsigned char undef;        //undefined reference
+};
+
+/* symbols collected by a single thread */
+struct builder_t {
+    struct rec_t *rec;
+    size_t count, alloc;
+    char *pool;                 //names of symbols and members
+    size_t used, size;
+    size_t *member;             //offsets of member names in pool
+    uint64_t *member_out;       //offsets of member names in index
+    unsigned int members, member_alloc;
+    unsigned int file;          //current file
+    unsigned int cur;           //current member
+    struct builder_t *next;
+};
+
+static __thread struct builder_t *local = NULL;
+
+/* kinds of directory entries */
+#define INDEX_ENTRY_DIR 1       //subdirectory
+#define INDEX_ENTRY_SO  2       //regular file offered to scan as shared object
+#define INDEX_ENTRY_AR  4       //regular file offered to scan as archive
+
+/* directory listing recorded by a walker thread */
+struct dir_rec_t {
+    char *path;
+    struct index_dir_t key;     //status and flags, offsets are set on save
+    struct index_entry_t *entry;//names are offsets in pool
+    unsigned int count, alloc;
+    char *pool;                 //names of entries
+    size_t used, size;
+    struct dir_rec_t *next;
+};
+
+static struct {
+    struct builder_t *list;     //builders of all threads
+    char **path;                //paths of files
+    struct index_file_t *key;   //statuses of files
+    unsigned int files, alloc;
+    struct dir_rec_t *dirs;     //listings of all directories
+    unsigned int dir_count;
+    unsigned int listed;        //directories which were actually read
+    unsigned int changed;       //some recorded entry was changed
+} build;
+
+/* index being refreshed */
+static struct {
+    struct index_map_t map;     //image == NULL if there is none
+    uint32_t *by_key;           //file numbers sorted by status
+    char **kept;                //new paths of unchanged files, NULL == not seen
+    uint64_t kept_count;
+    time_t start;               //directories modified since are not trusted
+} old;
+
+/* directory being listed by the calling thread and its old listing */
+static __thread struct dir_rec_t *dir_cur = NULL;
+static __thread const struct index_dir_t *dir_old = NULL;
+static __thread uint32_t dir_next;
+
+static pthread_mutex_t build_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* get builder of the calling thread */
+static struct builder_t* builder()
+{
+    if (!local) {
+        local = xcalloc(1, sizeof(struct builder_t));
+        pthread_mutex_lock(&build_lock);
+        local->next = build.list;
+        build.list = local;
+        pthread_mutex_unlock(&build_lock);
+    }
+    return local;
+}
+
+/* add string <str> of <len> bytes to <pool> of <size> bytes, <used> of them */
+static size_t pool_add(char** const pool, size_t* const used, size_t* const size,
+                       const char* const str, const size_t len)
+{
+    const size_t off = *used;
+
+    if (*used + len + 1 > *size) {
+        *size = (*used + len + 1) * 2;
+        *pool = xrealloc(*pool, *size);
+    }
+    memcpy(*pool + *used, str, len);
+    (*pool)[*used + len] = '\0';
+    *used += len + 1;
+    return off;
+}
+
+/* add file <path> with status <key> to file table,
+   build_lock must be held; its number is returned */
+static unsigned int add_file(char* const path, const struct index_file_t* const key)
+{
+    if (build.files == build.alloc) {
+        build.alloc = build.alloc ? build.alloc * 2 : 256;
+        build.path = xrealloc(build.path, sizeof(char*) * build.alloc);
+        build.key = xrealloc(build.key, sizeof(struct index_file_t) * build.alloc);
+    }
+    build.path[build.files] = path;
+    build.key[build.files] = *key;
+    return build.files++;
+}
+
+void index_file(const char* const path, const struct stat* const st, const unsigned int ar)
+{
+    struct builder_t *const b = builder();
+    struct index_file_t key;
+
+    make_key(st, ar, &key);
+    pthread_mutex_lock(&build_lock);
+    b->file = add_file(alloc_str(path), &key);
+    pthread_mutex_unlock(&build_lock);
+    b->cur = 0;
+}
+
+void index_file_drop()
+{
+    struct builder_t *const b = builder();
+
+    pthread_mutex_lock(&build_lock);
+    if (b->file == build.files - 1)
+        free(build.path[--build.files]);
+    pthread_mutex_unlock(&build_lock);
+}
+
+void index_member(const char* const name, const size_t len)
+{
+    struct builder_t *const b = builder();
+
+    if (b->members == b->member_alloc) {
+        b->member_alloc = b->member_alloc ? b->member_alloc * 2 : 64;
+        b->member = xrealloc(b->member, sizeof(size_t) * b->member_alloc);
+    }
+    b->member[b->members++] = pool_add(&b->pool, &b->used, &b->size, name, len);
+    b->cur = b->members;
+}
+
+/* add symbol <name> to the current file and member of the calling thread */
+static void add_rec(const char* const name, const unsigned char info, const unsigned char undef)
+{
+    struct builder_t *const b = local;
+
+    if (b->count == b->alloc) {
+        b->alloc = b->alloc ? b->alloc * 2 : 1024;
+        b->rec = xrealloc(b->rec, sizeof(struct rec_t) * b->alloc);
+    }
+    b->rec[b->count].name = pool_add(&b->pool, &b->used, &b->size, name, strlen(name));
+    b->rec[b->count].file = b->file;
+    b->rec[b->count].member = b->cur;
+    b->rec[b->count].info = info;
+    b->rec[b->count].undef = undef;
+    b->count++;
+}
+
+void index_symbol(const char* const name, const unsigned char info)
+{
+    add_rec(name, info, 0);
+}
+
+void index_reference(const char* const name, const unsigned char info)
+{
+    add_rec(name, info, 1);
+}
+
+
+/* comparison function for old file numbers by their statuses */
+static int compare_old(const void* const a, const void* const b)
+{
+    return compare_key(&old.map.file[*(const uint32_t*)a], &old.map.file[*(const uint32_t*)b]);
+}
+
+void index_load()
+{
+    const char *msg;
+    int err;
+
+    old.start = time(NULL);
+    if ((msg = index_map(opt.build_index, &old.map, &err))) {
+        // there is nothing to refresh yet
+        if (opt.verb && err != ENOENT) {
+            error(0, err, msg, opt.build_index);
+            error(0, 0, "warning: index will be built from scratch");
+        }
+        old.map.image = NULL;
+        return;
+    }
+
+    old.by_key = xmalloc(sizeof(uint32_t) * (old.map.files + 1));
+    for (uint64_t i=0; i < old.map.files; i++)
+        old.by_key[i] = i;
+    qsort(old.by_key, old.map.files, sizeof(uint32_t), compare_old);
+    old.kept = xcalloc(old.map.files + 1, sizeof(char*));
+}
+
+/* keep symbols of old file <i> found at <path> */
+static void keep_file(const uint32_t i, const char* const path)
+{
+    pthread_mutex_lock(&build_lock);
+    if (!old.kept[i]) {
+        old.kept[i] = alloc_str(path);
+        old.kept_count++;
+    }
+    pthread_mutex_unlock(&build_lock);
+}
+
+int index_known(const struct stat* const st, const char* const path)
+{
+    struct index_file_t key;
+    uint64_t lo = 0, hi = old.map.files;
+    const char *name;
+    unsigned int so, ar;
+    uint32_t i;
+
+    if (!old.map.image)
+        return 0;
+    make_key(st, 0, &key);
+    while (lo < hi) {
+        const uint64_t mid = lo + (hi - lo) / 2;
+        if (compare_key(&old.map.file[old.by_key[mid]], &key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == old.map.files || compare_key(&old.map.file[i = old.by_key[lo]], &key))
+        return 0;
+
+    // file must be still selected by the same type
+    name = strrchr(path, '/');
+    if (!file_wanted((name) ? name + 1 : path, &so, &ar) ||
+        !((old.map.file[i].flags & INDEX_AR) ? ar : so))
+        return 0;
+
+    keep_file(i, path);
+    return 1;
+}
+
+/* find directory or file record by <path> in <table> of <count> records
+   of <size> bytes sorted by path, path offset is the first field;
+   <count> is returned if there is none */
+static uint64_t find_path(const void* const table, const uint64_t count, const size_t size,
+                          const char* const path)
+{
+    uint64_t lo = 0, hi = count;
+
+    while (lo < hi) {
+        const uint64_t mid = lo + (hi - lo) / 2;
+        const uint64_t off = *(const uint64_t*)((const char*)table + mid * size);
+        const int res = strcmp(index_str(&old.map, off), path);
+        if (!res)
+            return mid;
+        if (res < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return count;
+}
+
+/* add entry <name> of <kind> to directory being listed */
+static void add_entry(const char* const name, const unsigned int kind)
+{
+    struct dir_rec_t *const d = dir_cur;
+
+    if (d->count == d->alloc) {
+        d->alloc = d->alloc ? d->alloc * 2 : 16;
+        d->entry = xrealloc(d->entry, sizeof(struct index_entry_t) * d->alloc);
+    }
+    memset(&d->entry[d->count], 0, sizeof(struct index_entry_t));
+    d->entry[d->count].name = pool_add(&d->pool, &d->used, &d->size, name, strlen(name));
+    d->entry[d->count].kind = kind;
+    d->count++;
+}
+
+int index_dir_open(const char* const path, const dev_t dev, const ino_t ino,
+                   const struct timespec* const mtime)
+{
+    struct dir_rec_t *const d = xcalloc(1, sizeof(struct dir_rec_t));
+    uint64_t i;
+
+    d->path = alloc_str(path);
+    d->key.dev = dev;
+    d->key.ino = ino;
+    d->key.mtime = mtime->tv_sec;
+    d->key.mtime_nsec = mtime->tv_nsec;
+    // entries added after the listing may keep the same mtime, while
+    // listings of followed symbolic links don't match physical walks
+    if (mtime->tv_sec >= old.start || (opt.fts & FTS_LOGICAL))
+        d->key.flags = INDEX_RACY;
+    dir_cur = d;
+    dir_old = NULL;
+
+    if (!old.map.image || (d->key.flags & INDEX_RACY) ||
+        (i = find_path(old.map.dir, old.map.dirs, sizeof(struct index_dir_t), path)) == old.map.dirs)
+        return 0;
+    dir_old = &old.map.dir[i];
+    if ((dir_old->flags & INDEX_RACY) || dir_old->dev != d->key.dev ||
+        dir_old->ino != d->key.ino || dir_old->mtime != d->key.mtime ||
+        dir_old->mtime_nsec != d->key.mtime_nsec || dir_old->entry > old.map.entries ||
+        dir_old->entries > old.map.entries - dir_old->entry) {
+        dir_old = NULL;
+        return 0;
+    }
+    dir_next = 0;
+    return 1;
+}
+
+const char* index_dir_next(int* const is_dir)
+{
+    const struct index_entry_t *e;
+    const char *name;
+
+    if (dir_next == dir_old->entries)
+        return NULL;
+    e = &old.map.entry[dir_old->entry + dir_next++];
+    name = index_str(&old.map, e->name);
+    add_entry(name, e->kind);
+    *is_dir = e->kind & INDEX_ENTRY_DIR;
+    return name;
+}
+
+void index_dir_add(const char* const name, const int is_dir)
+{
+    unsigned int so, ar, kind = INDEX_ENTRY_DIR;
+
+    if (!is_dir) {
+        kind = 0;
+        if (file_wanted(name, &so, &ar))
+            kind = ((so) ? INDEX_ENTRY_SO : 0) | ((ar) ? INDEX_ENTRY_AR : 0);
+    }
+    add_entry(name, kind);
+}
+
+int index_dir_keep(const char* const path)
+{
+    struct index_entry_t *const e = &dir_cur->entry[dir_cur->count - 1];
+    const char *const name = strrchr(path, '/');
+    unsigned int so, ar, want;
+    uint64_t i;
+
+    if (!file_wanted((name) ? name + 1 : path, &so, &ar))
+        return 1;
+    want = ((so) ? INDEX_ENTRY_SO : 0) | ((ar) ? INDEX_ENTRY_AR : 0);
+
+    if ((i = find_path(old.map.file, old.map.files, sizeof(struct index_file_t), path)) <
+        old.map.files) {
+        const struct index_file_t *const f = &old.map.file[i];
+        struct stat st;
+
+        // file of unwanted type would be rejected by its magic
+        if (!((f->flags & INDEX_AR) ? ar : so))
+            return 1;
+        memset(&st, 0, sizeof(st));
+        st.st_dev = f->dev;
+        st.st_ino = f->ino;
+        if (!file_seen(&st))
+            keep_file(i, path);
+        return 1;
+    }
+
+    // offered to scan as these types before, but nothing was found
+    if (!(want & ~e->kind))
+        return 1;
+    e->kind |= want;
+    __atomic_store_n(&build.changed, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+void index_dir_close(const int complete)
+{
+    struct dir_rec_t *const d = dir_cur;
+
+    if (!complete)
+        d->key.flags = INDEX_RACY;
+    pthread_mutex_lock(&build_lock);
+    d->next = build.dirs;
+    build.dirs = d;
+    build.dir_count++;
+    if (!dir_old)
+        build.listed++;
+    pthread_mutex_unlock(&build_lock);
+    dir_cur = NULL;
+    dir_old = NULL;
+}
+
+/* check whether refresh changed nothing: no file was scanned,
+   all files are kept under the same paths and no directory was read */
+static int up_to_date()
+{
+    if (!old.map.image || build.files || old.kept_count != old.map.files ||
+        build.listed || build.changed || build.dir_count != old.map.dirs)
+        return 0;
+    for (uint64_t i=0; i < old.map.files; i++)
+        if (strcmp(old.kept[i], index_str(&old.map, old.map.file[i].path)))
+            return 0;
+    return 1;
+}
+
+/* free refreshed index */
+static void old_free()
+{
+    if (!old.map.image)
+        return;
+    for (uint64_t i=0; i < old.map.files; i++)
+        free(old.kept[i]);
+    free(old.kept);
+    free(old.by_key);
+    munmap(old.map.image, old.map.size);
+    old.map.image = NULL;
+}
+
+/* symbol being written */
+struct out_t {
+    const char *name;
+    const char *member;         //NULL == none
+    const uint64_t *member_id;  //member number + 1 in the index
+    unsigned int file;          //file number in the index
+    unsigned char info;
+    unsigned char undef;        //undefined reference
+};
+
+/* file numbers sorted by path */
+static int compare_path(const void* const a, const void* const b)
+{
+    return strcmp(build.path[*(const unsigned int*)a], build.path[*(const unsigned int*)b]);
+}
+
+/* symbols sorted by name, file and member */
+static int compare_out(const void* const a, const void* const b)
+{
+    const struct out_t *const x = a, *const y = b;
+    int res;
+
+    if ((res = strcmp(x->name, y->name)))
+        return res;
+    if (x->file != y->file)
+        return (x->file < y->file) ? -1 : 1;
+    if (x->member != y->member) {
+        if (!x->member || !y->member)
+            return (x->member) ? 1 : -1;
+        if ((res = strcmp(x->member, y->member)))
+            return res;
+    }
+    if (x->undef != y->undef)
+        return (int)x->undef - (int)y->undef;
+    return (int)x->info - (int)y->info;
+}
+
+/* member name with place for its number in the index */
+struct member_ref_t {
+    const char *name;
+    uint64_t *id;
+};
+
+static int compare_member(const void* const a, const void* const b)
+{
+    return strcmp(((const struct member_ref_t*)a)->name, ((const struct member_ref_t*)b)->name);
+}
+
+/* write <len> bytes of <data> to <f>, *ok is reset on failure */
+static inline void put(FILE* const f, const void* const data, const size_t len, int* const ok)
+{
+    if (*ok && len && fwrite(data, len, 1, f) != 1)
+        *ok = 0;
+}
+
+/* growable dictionary being encoded */
+struct dict_t {
+    unsigned char *buf;
+    size_t used, size;
+};
+
+/* append LEB128 number <num> to <d> */
+static void put_num(struct dict_t* const d, uint64_t num)
+{
+    if (d->used + 10 > d->size) {
+        d->size = (d->used + 10) * 2;
+        d->buf = xrealloc(d->buf, d->size);
+    }
+    do {
+        d->buf[d->used++] = (num & 0x7f) | ((num > 0x7f) ? 0x80 : 0);
+        num >>= 7;
+    } while (num);
+}
+
+/* append <len> bytes of <data> to <d> */
+static void put_bytes(struct dict_t* const d, const void* const data, const size_t len)
+{
+    if (d->used + len > d->size) {
+        d->size = (d->used + len) * 2;
+        d->buf = xrealloc(d->buf, d->size);
+    }
+    memcpy(d->buf + d->used, data, len);
+    d->used += len;
+}
+
+/* displacements tried for a bucket before another seed is taken */
+#define HASH_TRIES (1U << 24)
+
+/* Build perfect hash of <n> distinct <names> with header fields <seed>,
+   <buckets> and <slots>; displacements of buckets are stored in <disp> and
+   name numbers of slots in <slot> (both allocated here), <n> for empty ones.
+   Spare slots keep the last buckets from searching for one of a few
+   free slots among all of them. */
+static void build_hash(const char* const* const names, const uint64_t n, uint64_t* const seed,
+                       uint64_t* const buckets, uint64_t* const slots,
+                       uint32_t** const disp, uint32_t** const slot)
+{
+    const uint64_t nb = n / 4 + 1;
+    const uint64_t ns = n + n / 64 + 1;
+    uint64_t *const hash = xmalloc(sizeof(uint64_t) * (n + 1));
+    uint32_t *const start = xmalloc(sizeof(uint32_t) * (nb + 1));
+    uint32_t *const member = xmalloc(sizeof(uint32_t) * (n + 1));
+    uint32_t *const order = xmalloc(sizeof(uint32_t) * (nb + 1));
+    uint32_t *const fill = xmalloc(sizeof(uint32_t) * (nb + 1));
+    uint64_t *const pos = xmalloc(sizeof(uint64_t) * (n + 1));
+    unsigned char *const taken = xmalloc(ns);
+    uint32_t max = 0;
+
+    *buckets = nb;
+    *slots = ns;
+    *disp = xmalloc(sizeof(uint32_t) * (nb + 1));
+    *slot = xmalloc(sizeof(uint32_t) * ns);
+
+    for (*seed = 0; ; (*seed)++) {
+        int ok = 1;
+
+        /* names grouped by buckets */
+        memset(start, 0, sizeof(uint32_t) * (nb + 1));
+        for (uint64_t k=0; k < n; k++) {
+            hash[k] = name_hash(names[k], *seed);
+            start[hash_bucket(hash[k], nb) + 1]++;
+        }
+        for (uint64_t b=0; b < nb; b++) {
+            if (start[b+1] > max)
+                max = start[b+1];
+            start[b+1] += start[b];
+            fill[b] = start[b];
+        }
+        for (uint64_t k=0; k < n; k++)
+            member[fill[hash_bucket(hash[k], nb)]++] = k;
+
+        /* the largest buckets are placed first, while there is room */
+        {
+            uint32_t *const by_size = xcalloc(max + 2, sizeof(uint32_t));
+            for (uint64_t b=0; b < nb; b++)
+                by_size[max - (start[b+1] - start[b]) + 1]++;
+            for (uint32_t s=0; s < max; s++)
+                by_size[s+1] += by_size[s];
+            for (uint64_t b=0; b < nb; b++)
+                order[by_size[max - (start[b+1] - start[b])]++] = b;
+            free(by_size);
+        }
+
+        memset(taken, 0, ns);
+        for (uint64_t k=0; k < ns; k++)
+            (*slot)[k] = n;
+        for (uint64_t i=0; i < nb && ok; i++) {
+            const uint64_t b = order[i], size = start[b+1] - start[b];
+            uint64_t d;
+
+            (*disp)[b] = 0;
+            if (!size)
+                continue;
+            for (d = 0; d < HASH_TRIES; d++) {
+                uint64_t j;
+                for (j = 0; j < size; j++) {
+                    pos[j] = hash_slot(hash[member[start[b] + j]], d, ns);
+                    if (taken[pos[j]])
+                        break;
+                    taken[pos[j]] = 2;
+                }
+                // undo tentative slots
+                for (uint64_t l=0; l < j; l++)
+                    taken[pos[l]] = 0;
+                if (j == size)
+                    break;
+            }
+            if (d == HASH_TRIES) {
+                ok = 0;
+                break;
+            }
+            (*disp)[b] = d;
+            for (uint64_t j=0; j < size; j++) {
+                taken[pos[j]] = 1;
+                (*slot)[pos[j]] = member[start[b] + j];
+            }
+        }
+        if (ok)
+            break;
+    }
+
+    free(hash);
+    free(start);
+    free(member);
+    free(order);
+    free(fill);
+    free(pos);
+    free(taken);
+}
+
+/* directory listings sorted by path */
+static int compare_dir(const void* const a, const void* const b)
+{
+    return strcmp((*(struct dir_rec_t* const*)a)->path, (*(struct dir_rec_t* const*)b)->path);
+}
+
+/* free directory listings */
+static void dirs_free()
+{
+    while (build.dirs) {
+        struct dir_rec_t *const d = build.dirs;
+        build.dirs = d->next;
+        free(d->path);
+        free(d->entry);
+        free(d->pool);
+        free(d);
+    }
+}
+
+/* number of file dropped from refreshed index */
+#define NOT_KEPT ((unsigned int)-1)
+
+/* pass symbols of unchanged files of the refreshed index to the builder
+   of the calling thread, as if they were scanned */
+static void keep_symbols()
+{
+    struct builder_t *const b = builder();
+    unsigned int *const old_file = xmalloc(sizeof(unsigned int) * (old.map.files + 1));
+    unsigned int *const old_member = xcalloc(old.map.members + 1, sizeof(unsigned int));
+    struct cursor_t c;
+
+    for (uint64_t i=0; i < old.map.files; i++) {
+        old_file[i] = NOT_KEPT;
+        if (old.kept[i]) {
+            old_file[i] = add_file(old.kept[i], &old.map.file[i]);
+            old.kept[i] = NULL;
+        }
+    }
+
+    memset(&c, 0, sizeof(c));
+    if (old.map.names)
+        seek_name(&c, &old.map, 0);
+    while (old.map.names) {
+        struct posting_t p;
+
+        while (get_posting(&c, &p)) {
+            if (old_file[p.file] == NOT_KEPT)
+                continue;
+            b->file = old_file[p.file];
+            b->cur = 0;
+            if (p.member) {
+                // each member name is added once
+                if (!old_member[p.member]) {
+                    const char *const name = index_str(&old.map, old.map.member[p.member-1]);
+                    index_member(name, strlen(name));
+                    old_member[p.member] = b->cur;
+                }
+                b->cur = old_member[p.member];
+            }
+            if (p.undef)
+                index_reference(c.name, p.info);
+            else
+                index_symbol(c.name, p.info);
+        }
+        if (!next_name(&c))
+            break;
+    }
+
+    free(c.name);
+    free(old_file);
+    free(old_member);
+}
+
+void index_save()
+{
+    struct index_hdr_t hdr;
+    struct index_file_t file;
+    struct out_t *out;
+    struct member_ref_t *ref;
+    const char **names;
+    unsigned int *order, *rank;
+    uint64_t *path_off, *member_off, *block, off, members = 0;
+    uint32_t *disp, *slot;
+    struct dict_t dict;
+    struct dir_rec_t **dir;
+    struct index_dir_t dir_out;
+    size_t count = 0, refs = 0, undefs = 0, pos = 0;
+    unsigned int scanned = build.files;
+    char *tmp;
+    FILE *f;
+    int ok = 1;
+
+    if (up_to_date()) {
+        if (opt.verb >= V_VERBOSE)
+            printf("--> Index %s is up to date\n", opt.build_index);
+        old_free();
+        dirs_free();
+        return;
+    }
+
+    /* unchanged files join scanned ones */
+    if (old.map.image)
+        keep_symbols();
+
+    memset(&hdr, 0, sizeof(hdr));
+
+    /* files are numbered in path order */
+    order = xmalloc(sizeof(unsigned int) * (build.files + 1));
+    rank = xmalloc(sizeof(unsigned int) * (build.files + 1));
+    path_off = xmalloc(sizeof(uint64_t) * (build.files + 1));
+    for (unsigned int i=0; i < build.files; i++)
+        order[i] = i;
+    qsort(order, build.files, sizeof(unsigned int), compare_path);
+    for (unsigned int i=0; i < build.files; i++)
+        rank[order[i]] = i;
+
+    /* gather symbols and member names of all threads */
+    for (struct builder_t *b = build.list; b; b = b->next) {
+        count += b->count;
+        refs += b->members;
+    }
+    out = xmalloc(sizeof(struct out_t) * (count + 1));
+    ref = xmalloc(sizeof(struct member_ref_t) * (refs + 1));
+    count = refs = 0;
+    for (struct builder_t *b = build.list; b; b = b->next) {
+        b->member_out = xmalloc(sizeof(uint64_t) * (b->members + 1));
+        for (unsigned int i=0; i < b->members; i++) {
+            ref[refs].name = b->pool + b->member[i];
+            ref[refs++].id = &b->member_out[i];
+        }
+        for (size_t i=0; i < b->count; i++, count++) {
+            const unsigned int m = b->rec[i].member;
+            out[count].name = b->pool + b->rec[i].name;
+            out[count].member = (m) ? b->pool + b->member[m-1] : NULL;
+            out[count].member_id = (m) ? &b->member_out[m-1] : NULL;
+            out[count].file = rank[b->rec[i].file];
+            out[count].info = b->rec[i].info;
+            out[count].undef = b->rec[i].undef;
+            undefs += b->rec[i].undef;
+        }
+    }
+    qsort(out, count, sizeof(struct out_t), compare_out);
+    qsort(ref, refs, sizeof(struct member_ref_t), compare_member);
+
+    /* lay out string pool: empty string, members, paths;
+       equal members are stored once */
+    member_off = xmalloc(sizeof(uint64_t) * (refs + 1));
+    off = 1;
+    for (size_t k=0; k < refs; k++) {
+        if (k && !strcmp(ref[k].name, ref[k-1].name)) {
+            *ref[k].id = *ref[k-1].id;
+            continue;
+        }
+        member_off[members] = off;
+        *ref[k].id = ++members;
+        off += strlen(ref[k].name) + 1;
+    }
+    for (unsigned int i=0; i < build.files; i++) {
+        path_off[i] = off;
+        off += strlen(build.path[order[i]]) + 1;
+    }
+
+    /* directories in path order, their paths and entry names follow */
+    dir = xmalloc(sizeof(struct dir_rec_t*) * (build.dir_count + 1));
+    build.dir_count = 0;
+    for (struct dir_rec_t *d = build.dirs; d; d = d->next)
+        dir[build.dir_count++] = d;
+    qsort(dir, build.dir_count, sizeof(struct dir_rec_t*), compare_dir);
+    hdr.entries = 0;
+    for (unsigned int i=0; i < build.dir_count; i++) {
+        dir[i]->key.path = off;
+        dir[i]->key.entry = hdr.entries;
+        dir[i]->key.entries = dir[i]->count;
+        off += strlen(dir[i]->path) + 1;
+        for (unsigned int k=0; k < dir[i]->count; k++) {
+            const size_t len = strlen(dir[i]->pool + dir[i]->entry[k].name) + 1;
+            dir[i]->entry[k].name = off;
+            off += len;
+        }
+        hdr.entries += dir[i]->count;
+    }
+
+    /* front coded dictionary of distinct names with their postings */
+    names = xmalloc(sizeof(char*) * (count + 1));
+    block = xmalloc(sizeof(uint64_t) * (count / INDEX_BLOCK + 1));
+    memset(&dict, 0, sizeof(dict));
+    while (pos < count) {
+        const char *const name = out[pos].name;
+        size_t end = pos + 1, prefix = 0, len = strlen(name);
+        unsigned int file = 0;
+
+        for (; end < count && !strcmp(out[end].name, name); end++);
+        if (hdr.names % INDEX_BLOCK)
+            for (const char *prev = names[hdr.names - 1];
+                 prefix < len && prev[prefix] == name[prefix]; prefix++);
+        else
+            block[hdr.names / INDEX_BLOCK] = dict.used;
+        names[hdr.names++] = name;
+        put_num(&dict, prefix);
+        put_num(&dict, len - prefix);
+        put_bytes(&dict, name + prefix, len - prefix);
+        put_num(&dict, end - pos);
+        for (; pos < end; pos++) {
+            put_num(&dict, out[pos].file - file);
+            put_num(&dict, ((out[pos].member_id) ? *out[pos].member_id : 0) << 1 |
+                           ((out[pos].undef) ? INDEX_UNDEF : 0));
+            put_bytes(&dict, &out[pos].info, 1);
+            file = out[pos].file;
+        }
+    }
+    build_hash(names, hdr.names, &hdr.seed, &hdr.buckets, &hdr.slots, &disp, &slot);
+
+    memcpy(hdr.magic, INDEX_MAGIC, sizeof(hdr.magic));
+    hdr.order = INDEX_ORDER;
+    hdr.block = INDEX_BLOCK;
+    hdr.files = build.files;
+    hdr.file_off = sizeof(hdr);
+    hdr.syms = count;
+    hdr.block_off = hdr.file_off + sizeof(struct index_file_t) * hdr.files;
+    hdr.members = members;
+    hdr.member_off = hdr.block_off +
+                     sizeof(uint64_t) * ((hdr.names + INDEX_BLOCK - 1) / INDEX_BLOCK);
+    hdr.dirs = build.dir_count;
+    hdr.dir_off = hdr.member_off + sizeof(uint64_t) * hdr.members;
+    hdr.entry_off = hdr.dir_off + sizeof(struct index_dir_t) * hdr.dirs;
+    hdr.disp_off = hdr.entry_off + sizeof(struct index_entry_t) * hdr.entries;
+    hdr.slot_off = hdr.disp_off + sizeof(uint32_t) * hdr.buckets;
+    hdr.dict_off = hdr.slot_off + sizeof(uint32_t) * hdr.slots;
+    hdr.dict_size = dict.used;
+    hdr.str_off = hdr.dict_off + hdr.dict_size;
+    hdr.str_size = off;
+
+    // replace index atomically, it may be queried meanwhile
+    tmp = xmalloc(strlen(opt.build_index) + sizeof(".tmp"));
+    strcpy(tmp, opt.build_index);
+    strcat(tmp, ".tmp");
+    if (!(f = fopen(tmp, "w")))
+        error(ERR_IO, errno, "i/o error: can't write index %s", tmp);
+
+    put(f, &hdr, sizeof(hdr), &ok);
+    for (unsigned int i=0; i < build.files; i++) {
+        file = build.key[order[i]];
+        file.path = path_off[i];
+        put(f, &file, sizeof(file), &ok);
+    }
+    put(f, block, sizeof(uint64_t) * ((hdr.names + INDEX_BLOCK - 1) / INDEX_BLOCK), &ok);
+    put(f, member_off, sizeof(uint64_t) * hdr.members, &ok);
+    for (unsigned int i=0; i < build.dir_count; i++) {
+        dir_out = dir[i]->key;
+        put(f, &dir_out, sizeof(dir_out), &ok);
+    }
+    for (unsigned int i=0; i < build.dir_count; i++)
+        put(f, dir[i]->entry, sizeof(struct index_entry_t) * dir[i]->count, &ok);
+    put(f, disp, sizeof(uint32_t) * hdr.buckets, &ok);
+    put(f, slot, sizeof(uint32_t) * hdr.slots, &ok);
+    put(f, dict.buf, dict.used, &ok);
+    put(f, "", 1, &ok);
+    for (size_t k=0; k < refs; k++)
+        if (!k || *ref[k].id != *ref[k-1].id)
+            put(f, ref[k].name, strlen(ref[k].name) + 1, &ok);
+    for (unsigned int i=0; i < build.files; i++)
+        put(f, build.path[order[i]], strlen(build.path[order[i]]) + 1, &ok);
+    for (unsigned int i=0; i < build.dir_count; i++) {
+        put(f, dir[i]->path, strlen(dir[i]->path) + 1, &ok);
+        put(f, dir[i]->pool, dir[i]->used, &ok);
+    }
+
+    if (fclose(f))
+        ok = 0;
+    if (!ok || rename(tmp, opt.build_index)) {
+        const int err = errno;
+        unlink(tmp);
+        error(ERR_IO, err, "i/o error: can't write index %s", opt.build_index);
+    }
+    if (opt.verb >= V_VERBOSE)
+        printf("--> %zu symbols, %zu references of %u files (%u scanned) and %u "
+               "directories (%u read) are written to %s\n", count - undefs, undefs,
+               build.files, scanned, build.dir_count, build.listed, opt.build_index);
+
+    old_free();
+    dirs_free();
+    free(dir);
+    free(tmp);
+    free(out);
+    free(ref);
+    free(names);
+    free(block);
+    free(dict.buf);
+    free(disp);
+    free(slot);
+    free(order);
+    free(rank);
+    free(path_off);
+    free(member_off);
+    for (unsigned int i=0; i < build.files; i++)
+        free(build.path[i]);
+    free(build.path);
+    free(build.key);
+    while (build.list) {
+        struct builder_t *const b = build.list;
+        build.list = b->next;
+        free(b->rec);
+        free(b->pool);
+        free(b->member);
+        free(b->member_out);
+        free(b);
+    }
+}
+
+/********************************************************************
+ *                             QUERIES                              *
+ ********************************************************************/
+
+static struct index_map_t idx;   //queried index
+static unsigned char *sel;      //file selection, see file_selected()
+
+extern struct str_t sp;         //all search pathes (string array)
+
+/* check whether <path> lies in the search path given by user */
+static int in_search_path(const char* const path)
+{
+    //the last element is NULL
+    for (unsigned int i=0; i < sp.size-1; i++) {
+        size_t len = strlen(sp.str[i]);
+        while (len > 1 && sp.str[i][len-1] == '/')
+            len--;
+        // the root directory keeps its slash
+        if (!strncmp(path, sp.str[i], len) &&
+            (path[len] == '/' || path[len] == '\0' || sp.str[i][len-1] == '/'))
+            return 1;
+    }
+    return 0;
+}
+
+/* check whether indexed file <i> would be scanned by the current options,
+   the decision is cached per file
+   1 == selected
+   0 == skipped */
+static int file_selected(const uint64_t i)
+{
+    enum {SEL_KNOWN = 1, SEL_YES = 2};
+
+    if (!sel[i]) {
+        const char *const path = index_str(&idx, idx.file[i].path);
+        const char *const name = strrchr(path, '/');
+        unsigned int so, ar;
+
+        sel[i] = SEL_KNOWN;
+        if ((opt.dp || in_search_path(path)) &&
+            file_wanted((name) ? name + 1 : path, &so, &ar) &&
+            ((idx.file[i].flags & INDEX_AR) ? ar : so))
+            sel[i] |= SEL_YES;
+    }
+    return (sel[i] & SEL_YES) != 0;
+}
+
+/* report user-provided symbols matching the current name of <c>:
+   files defining them or referencing them for --consumers */
+static void report_name(struct cursor_t* const c)
+{
+    struct posting_t p;
+    uint64_t last = idx.files;
+
+    if (!symbol_wanted(c->name))
+        return;
+    while (get_posting(c, &p)) {
+        if (p.undef != (opt.consumers != 0) || !file_selected(p.file))
+            continue;
+        // a consumer is reported once, even if several members refer
+        if (opt.consumers && p.file == last)
+            continue;
+        check_symbol(c->name, index_str(&idx, idx.file[p.file].path));
+        last = p.file;
+    }
+}
+
+/* report names starting with <prefix> of <len> bytes */
+static void report_range(struct cursor_t* const c, const char* const prefix, const size_t len)
+{
+    uint64_t lo = 0, hi = (idx.names + INDEX_BLOCK - 1) / INDEX_BLOCK;
+
+    /* the range starts in the last block whose first name is lower */
+    while (hi - lo > 1) {
+        const uint64_t mid = lo + (hi - lo) / 2;
+        seek_name(c, &idx, mid * INDEX_BLOCK);
+        if (strcmp(c->name, prefix) < 0)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    seek_name(c, &idx, lo * INDEX_BLOCK);
+    do {
+        const int res = strncmp(c->name, prefix, len);
+        if (res > 0)
+            break;
+        if (!res)
+            report_name(c);
+    } while (next_name(c));
+}
+
+/* prefix of regexp */
+struct prefix_t {
+    const char *str;
+    size_t len;
+};
+
+static int compare_prefix(const void* const a, const void* const b)
+{
+    return strcmp(((const struct prefix_t*)a)->str, ((const struct prefix_t*)b)->str);
+}
+
+/* Get name ranges of anchored regexps to <prefix>, none of them lies
+   within another one; their number is returned, 0 if some regexp has
+   no literal prefix and all names must be matched. */
+static unsigned int regexp_ranges(struct prefix_t* const prefix)
+{
+    unsigned int n = 0;
+
+    for (unsigned int i=0; i < symbol.size; i++)
+        if (!(prefix[i].str = mregex_prefix(i, &prefix[i].len)))
+            return 0;
+    qsort(prefix, symbol.size, sizeof(struct prefix_t), compare_prefix);
+    // a prefix extending the previous one adds no names
+    for (unsigned int i=0; i < symbol.size; i++)
+        if (!n || strncmp(prefix[i].str, prefix[n-1].str, prefix[n-1].len))
+            prefix[n++] = prefix[i];
+    return n;
+}
+
+void index_query()
+{
+    struct cursor_t c;
+    const char *msg;
+    int err;
+
+    if ((msg = index_map(opt.index, &idx, &err)))
+        error(ERR_IO, err, msg, opt.index);
+    sel = xcalloc(idx.files + 1, 1);
+    memset(&c, 0, sizeof(c));
+
+    if (opt.verb >= V_VERBOSE)
+        printf("--> Looking up %lu symbols of %lu files in index %s\n",
+               (unsigned long)idx.syms, (unsigned long)idx.files, opt.index);
+
+    if (idx.names && !opt.re && !opt.cas) {
+        /* exact symbols: the only candidate is given by perfect hash */
+        for (unsigned int i=0; i < symbol.size; i++) {
+            const uint64_t h = name_hash(symbol.str[i], idx.seed);
+            const uint64_t k = idx.slot[hash_slot(h, idx.disp[hash_bucket(h, idx.buckets)],
+                                                  idx.slots)];
+            if (k >= idx.names)
+                continue;
+            seek_name(&c, &idx, k);
+            if (!strcmp(c.name, symbol.str[i]))
+                report_name(&c);
+        }
+    }
+    else if (idx.names) {
+        struct prefix_t *const prefix = xmalloc(sizeof(struct prefix_t) * (symbol.size + 1));
+        unsigned int ranges = (opt.re) ? regexp_ranges(prefix) : 0;
+
+        /* anchored regexps: only names of their prefixes are matched */
+        for (unsigned int i=0; i < ranges; i++)
+            report_range(&c, prefix[i].str, prefix[i].len);
+        /* case insensitive symbols and other regexps: each distinct name once */
+        if (!ranges) {
+            seek_name(&c, &idx, 0);
+            do
+                report_name(&c);
+            while (next_name(&c));
+        }
+        free(prefix);
+    }
+
+    free(c.name);
+    free(sel);
+    munmap(idx.image, idx.size);
+}
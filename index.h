@@ -0,0 +1,86 @@
+/*
+ *  Persistent symbol index
+ *  Copyright © 2007-2011 Andrew Savchenko
+ *
+ *  This file is part of symlookup.
+ *
+ *  symlookup is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 3 as
+ *  published by the Free Software Foundation
+ *
+ *  symlookup is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License version 3 for more details.
+ *
+ *  You should have received a copy of the GNU General Public License version 3
+ *  along with symlookup. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SL_INDEX_H
+#define SL_INDEX_H
+
+#include <stddef.h>
+
+#include <sys/stat.h>
+
+/* map existing opt.build_index to be refreshed, if any */
+void index_load();
+
+/* Check whether file <path> of status <st> is recorded in the refreshed
+   index unchanged; its symbols are kept then.
+   1 == known, skip it
+   0 == file must be scanned */
+int index_known(const struct stat* const st, const char* const path);
+
+/* Start listing of directory <path> with device <dev>, inode <ino> and
+   modification time <mtime> by the calling walker thread.
+   1 == directory is unchanged since refreshed index, its entries are
+        taken from index_dir_next() instead of reading it
+   0 == directory must be read, its entries are passed to index_dir_add() */
+int index_dir_open(const char* const path, const dev_t dev, const ino_t ino,
+                   const struct timespec* const mtime);
+
+/* next entry of unchanged directory, <is_dir> is set for subdirectories;
+   NULL stands for the end */
+const char* index_dir_next(int* const is_dir);
+
+/* Check file <path> returned by index_dir_next() without stat.
+   1 == its symbols are kept or it is known to have none
+   0 == file must be stat'ed and scanned as usual */
+int index_dir_keep(const char* const path);
+
+/* record entry <name> of directory being read, <is_dir> is set
+   for subdirectories; only regular files and directories are recorded */
+void index_dir_add(const char* const name, const int is_dir);
+
+/* finish directory listing, <complete> is 0 if it wasn't read entirely */
+void index_dir_close(const int complete);
+
+/* Index building, called by scanners of the calling thread:
+   start file <path> of status <st> (NULL if unknown), <ar> is set for
+   archives; all symbols up to the next call belong to it */
+void index_file(const char* const path, const struct stat* const st, const unsigned int ar);
+
+/* forget the current file before anything was recorded to it, it must be
+   the last file started (the io_uring reader runs in a single thread) */
+void index_file_drop();
+
+/* start archive member <name> of <len> bytes in the current file */
+void index_member(const char* const name, const size_t len);
+
+/* add defined symbol <name> with ELF <info> (binding and type)
+   to the current file and member */
+void index_symbol(const char* const name, const unsigned char info);
+
+/* add undefined symbol <name> with ELF <info> referenced by the current
+   file and member, for --consumers queries */
+void index_reference(const char* const name, const unsigned char info);
+
+/* write all collected and kept symbols to opt.build_index */
+void index_save();
+
+/* answer symbol query from opt.index instead of scanning */
+void index_query();
+
+#endif /* SL_INDEX_H */
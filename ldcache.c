@@ -0,0 +1,183 @@
+/*
+ *  Dynamic linker cache reader
+ *  Copyright © 2007-2011 Andrew Savchenko
+ *
+ *  This file is part of symlookup.
+ *
+ *  symlookup is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 3 as
+ *  published by the Free Software Foundation
+ *
+ *  symlookup is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License version 3 for more details.
+ *
+ *  You should have received a copy of the GNU General Public License version 3
+ *  along with symlookup. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <error.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "symlookup.h"
+#include "safemem.h"
+#include "ldcache.h"
+
+/* The cache is written by ldconfig(8) in host byte order, there are
+ * two formats of it:
+ *   old  header, entries, strings; string offsets are relative
+ *        to the end of the entries;
+ *   new  header, entries, strings; string offsets are relative
+ *        to the start of the header.
+ * Usually both are present: the new cache follows the old entries,
+ * aligned to 8 bytes, and is preferred then, as ld.so does. Each entry
+ * holds offsets of a soname and of the full path of the library. */
+
+#define LDCACHE_OLD     "ld.so-1.7.0"
+#define LDCACHE_NEW     "glibc-ld.so.cache"
+#define LDCACHE_VERSION "1.1"
+
+struct old_entry_t {
+    int32_t flags;
+    uint32_t key;               //soname
+    uint32_t value;             //path
+};
+
+struct old_hdr_t {
+    char magic[sizeof(LDCACHE_OLD) - 1];
+    uint32_t nlibs;
+};
+
+struct new_entry_t {
+    int32_t flags;
+    uint32_t key;               //soname
+    uint32_t value;             //path
+    uint32_t osversion;
+    uint64_t hwcap;
+};
+
+struct new_hdr_t {
+    char magic[sizeof(LDCACHE_NEW) - 1];
+    char version[sizeof(LDCACHE_VERSION) - 1];
+    uint32_t nlibs;
+    uint32_t len_strings;
+    uint8_t flags;
+    uint8_t padding[3];
+    uint32_t extension_offset;
+    uint32_t unused[3];
+};
+
+extern struct str_t sp; //all search pathes (string array)
+
+/* check whether cache <buf> of <size> bytes has new format header at <off> */
+static int is_new(const char* const buf, const size_t size, const size_t off)
+{
+    return off <= size && size - off >= sizeof(struct new_hdr_t) &&
+           !memcmp(buf + off, LDCACHE_NEW LDCACHE_VERSION,
+                   sizeof(LDCACHE_NEW LDCACHE_VERSION) - 1);
+}
+
+/* add soname at offset <key> and path at offset <value> of strings <base>
+   to <soname> (unless NULL) and <path>, they must lie within cache <buf>
+   of <size> bytes
+   0 == broken offset */
+static int add_entry(const char* const buf, const size_t size, const size_t base,
+                     const uint32_t key, const uint32_t value,
+                     struct str_t* const soname, struct str_t* const path)
+{
+    if (base > size || value >= size - base ||
+        !memchr(buf + base + value, '\0', size - base - value))
+        return 0;
+    if (soname) {
+        if (key >= size - base || !memchr(buf + base + key, '\0', size - base - key))
+            return 0;
+        grow_str(soname, buf + base + key);
+    }
+    grow_str(path, buf + base + value);
+    return 1;
+}
+
+int ldcache_read(const char* const file, struct str_t* const soname,
+                 struct str_t* const path)
+{
+    FILE *f;
+    char *buf;
+    long len;
+    size_t size, off, base;
+    int ok = 1;
+
+    if (!(f = fopen(file, "r")))
+        return 1;
+    if (fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0 || fseek(f, 0, SEEK_SET)) {
+        fclose(f);
+        return 1;
+    }
+    size = len;
+    buf = xmalloc(size + 1);
+    if (fread(buf, 1, size, f) != size) {
+        fclose(f);
+        free(buf);
+        return 1;
+    }
+    fclose(f);
+
+    off = 0;
+    if (size >= sizeof(struct old_hdr_t) &&
+        !memcmp(buf, LDCACHE_OLD, sizeof(LDCACHE_OLD) - 1)) {
+        const struct old_hdr_t *const hdr = (const struct old_hdr_t*)buf;
+        const size_t nlibs = hdr->nlibs;
+
+        if (nlibs > (size - sizeof(*hdr)) / sizeof(struct old_entry_t))
+            ok = 0;
+        else {
+            // strings of old entries follow them
+            base = sizeof(*hdr) + nlibs * sizeof(struct old_entry_t);
+            off = (base + 7) & ~(size_t)7;
+            if (!is_new(buf, size, off))
+                for (size_t i=0; i < nlibs && ok; i++) {
+                    struct old_entry_t e;
+                    memcpy(&e, buf + sizeof(*hdr) + i * sizeof(e), sizeof(e));
+                    ok = add_entry(buf, size, base, e.key, e.value, soname, path);
+                }
+        }
+    }
+    else if (!is_new(buf, size, 0))
+        ok = 0;
+
+    if (ok && is_new(buf, size, off)) {
+        struct new_hdr_t hdr;
+
+        memcpy(&hdr, buf + off, sizeof(hdr));
+        if (hdr.nlibs > (size - off - sizeof(hdr)) / sizeof(struct new_entry_t))
+            ok = 0;
+        for (size_t i=0; i < hdr.nlibs && ok; i++) {
+            struct new_entry_t e;
+            memcpy(&e, buf + off + sizeof(hdr) + i * sizeof(e), sizeof(e));
+            ok = add_entry(buf, size, off, e.key, e.value, soname, path);
+        }
+    }
+    free(buf);
+    return (ok) ? 0 : 2;
+}
+
+void ldcache_load()
+{
+    const unsigned int count = sp.size;
+
+    switch (ldcache_read(opt.ldcache, NULL, &sp)) {
+        case 1:
+            error(ERR_IO, errno, "i/o error: can't read ld cache %s", opt.ldcache);
+            break;
+        case 2:
+            error(ERR_IO, 0, "%s is not a valid ld cache", opt.ldcache);
+            break;
+    }
+
+    if (opt.verb >= V_VERBOSE)
+        printf("--> %u libraries are listed in %s\n", sp.size - count, opt.ldcache);
+}
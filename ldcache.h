@@ -0,0 +1,40 @@
+/*
+ *  Dynamic linker cache reader
+ *  Copyright © 2007-2011 Andrew Savchenko
+ *
+ *  This file is part of symlookup.
+ *
+ *  symlookup is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 3 as
+ *  published by the Free Software Foundation
+ *
+ *  symlookup is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License version 3 for more details.
+ *
+ *  You should have received a copy of the GNU General Public License version 3
+ *  along with symlookup. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SL_LDCACHE_H
+#define SL_LDCACHE_H
+
+/* default cache of ldconfig(8) */
+#define LDCACHE_DEFAULT "/etc/ld.so.cache"
+
+struct str_t;
+
+/* Read ld.so.cache <file>: sonames of all listed libraries are added
+   to <soname> (unless NULL) and their paths to <path>, in cache order.
+   0 == ok
+   1 == i/o error, errno is set
+   2 == file is not a valid ld cache; some entries may be added */
+int ldcache_read(const char* const file, struct str_t* const soname,
+                 struct str_t* const path);
+
+/* add all libraries listed in ld.so.cache opt.ldcache to the search
+   path array, so only they are scanned */
+void ldcache_load();
+
+#endif /* SL_LDCACHE_H */
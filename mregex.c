@@ -0,0 +1,1086 @@
+/*
+ *  Multi-pattern regular expression matching
+ *  Copyright © 2007-2011 Andrew Savchenko
+ *
+ *  This file is part of symlookup.
+ *
+ *  symlookup is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 3 as
+ *  published by the Free Software Foundation
+ *
+ *  symlookup is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License version 3 for more details.
+ *
+ *  You should have received a copy of the GNU General Public License version 3
+ *  along with symlookup. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <error.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <regex.h>
+
+#include "symlookup.h"
+#include "safemem.h"
+#include "mregex.h"
+
+/* All user regular expressions are compiled into a single Thompson NFA,
+ * each pattern ends in its own match state. The NFA is run as a DFA
+ * built lazily: a DFA state is a set of NFA states, its transitions are
+ * computed on the first use only and cached. Every DFA state knows which
+ * patterns match at that point, so a symbol name is scanned once for all
+ * patterns. Searches are unanchored: start states of all patterns are
+ * added after each character, '^' holds at the first character only.
+ *
+ * Bytes are grouped into classes which no pattern distinguishes, so
+ * transition tables are small. The NFA is read only after compilation,
+ * DFA caches are per thread and are flushed when they grow too big.
+ *
+ * Only plain POSIX ERE syntax is supported: GNU extensions, back
+ * references, collating elements and such are left to regexec(),
+ * as well as patterns which would produce too big NFA. */
+
+/* limits */
+#define MAX_REPEAT      256         //max bound of {m,n}
+#define MAX_NFA         100000      //max NFA states of a single pattern
+#define MAX_DFA         10000       //max cached DFA states
+#define MAX_DFA_MEM     (32 << 20)  //max memory of cached DFA states
+#define MAX_DFA_FILTER  4           //max DFA patterns to prefilter
+#define MAX_LITERALS    4           //max literals for string table search
+
+/* NFA state types */
+enum {
+    N_CHAR,     //character of class <arg>
+    N_SPLIT,    //epsilon to both <out> and <out1>
+    N_BOL,      //beginning of line assertion
+    N_EOL,      //end of line assertion
+    N_MATCH     //pattern <arg> matched
+};
+
+struct nstate_t {
+    unsigned char type;
+    unsigned int arg;
+    unsigned int out, out1;
+};
+
+/* syntax tree node types */
+enum {
+    A_CLASS,    //character of class <cls>
+    A_BOL,
+    A_EOL,
+    A_CAT,      //<l> followed by <r>
+    A_ALT,      //<l> or <r>
+    A_REPEAT    //<l> from <min> to <max> (-1 == infinite) times
+};
+
+struct ast_t {
+    int type;
+    unsigned int cls;
+    int min, max;
+    struct ast_t *l, *r;
+};
+
+/* parser state */
+struct parse_t {
+    const unsigned char *p;     //current position
+    int icase;                  //ignore case
+    int bad;                    //unsupported syntax found
+};
+
+/* necessary conditions of pattern match, cheap to check */
+struct filter_t {
+    char *prefix;               //literal starting every matched name
+    size_t prefix_len;
+    char *lit;                  //literal contained in every matched name
+    size_t lit_len;
+    size_t min_len;             //bounds of matched name length
+    size_t max_len;
+};
+
+/* the automaton shared by all threads */
+static struct {
+    struct nstate_t *state;     //NFA states
+    unsigned int count, alloc;
+    uint64_t (*cls)[4];         //character classes
+    unsigned int ncls, cls_alloc;
+    unsigned int *start;        //start states of DFA patterns
+    unsigned int *pattern;      //indexes of DFA patterns
+    unsigned int nstart;
+    unsigned char eq[256];      //byte to equivalence class
+    unsigned char rep[256];     //equivalence class representative byte
+    unsigned int neq;           //number of equivalence classes
+    unsigned int *fallback;     //patterns matched by regexec()
+    unsigned int nfallback;
+    unsigned int words;         //words in result bitset
+    struct filter_t *filter;    //per pattern prefilters
+    int dfa_filter;             //check prefilters before DFA run
+    const char *lit[MAX_LITERALS];  //literals required by all patterns
+    size_t lit_len[MAX_LITERALS];
+    unsigned int nlit;
+} nfa;
+
+/* DFA state */
+struct dstate_t {
+    unsigned int *set;          //sorted NFA states (characters, matches, '$')
+    unsigned int n;
+    uint32_t hash;
+    unsigned int *acc;          //patterns matched here
+    unsigned int nacc;
+    unsigned int *acc_end;      //patterns matched if the name ends here
+    unsigned int nacc_end;
+    struct dstate_t *hnext;     //hash chain
+    struct dstate_t *next[];    //transitions by equivalence class
+};
+
+/* per-thread DFA cache */
+struct dfa_t {
+    struct dstate_t **htab;     //hash table of states
+    unsigned int hsize;
+    unsigned int count;         //number of states
+    size_t mem;                 //memory used by states
+    struct dstate_t *start;     //state at the beginning of name
+    unsigned int *mark;         //NFA state marks for closure
+    unsigned int gen;           //current mark generation
+    unsigned int *stack;        //closure stack
+    unsigned int *buf;          //closure result
+    unsigned int *moves;        //step targets
+    uint64_t *result;           //matched patterns
+};
+
+static pthread_key_t dfa_key;
+
+static void free_dfa(void* const arg);
+
+/********************************************************************
+ *                            COMPILER                              *
+ ********************************************************************/
+
+/* add character class, <set> is copied */
+static unsigned int new_class(const uint64_t* const set)
+{
+    if (nfa.ncls == nfa.cls_alloc) {
+        nfa.cls_alloc = nfa.cls_alloc ? nfa.cls_alloc * 2 : 64;
+        nfa.cls = xrealloc(nfa.cls, sizeof(*nfa.cls) * nfa.cls_alloc);
+    }
+    memcpy(nfa.cls[nfa.ncls], set, sizeof(*nfa.cls));
+    return nfa.ncls++;
+}
+
+static inline void set_byte(uint64_t* const set, const unsigned int c)
+{
+    set[c >> 6] |= 1ULL << (c & 63);
+}
+
+static inline int has_byte(const uint64_t* const set, const unsigned int c)
+{
+    return (set[c >> 6] >> (c & 63)) & 1;
+}
+
+/* add other case of all letters in <set> */
+static void fold_class(uint64_t* const set)
+{
+    for (unsigned int c = 0; c < 256; c++)
+        if (has_byte(set, c)) {
+            set_byte(set, tolower(c));
+            set_byte(set, toupper(c));
+        }
+}
+
+static struct ast_t* new_node(const int type, struct ast_t* const l, struct ast_t* const r)
+{
+    struct ast_t *const node = xcalloc(1, sizeof(struct ast_t));
+    node->type = type;
+    node->l = l;
+    node->r = r;
+    return node;
+}
+
+static void free_ast(struct ast_t* const node)
+{
+    if (!node)
+        return;
+    free_ast(node->l);
+    free_ast(node->r);
+    free(node);
+}
+
+/* named class [:name:] */
+static int named_class(const char* const name, const size_t len, uint64_t* const set)
+{
+    static const struct {
+        const char *name;
+        int (*func)(int);
+    } classes[] = {
+        {"alpha", isalpha}, {"digit", isdigit}, {"alnum", isalnum},
+        {"upper", isupper}, {"lower", islower}, {"space", isspace},
+        {"blank", isblank}, {"punct", ispunct}, {"print", isprint},
+        {"graph", isgraph}, {"cntrl", iscntrl}, {"xdigit", isxdigit}
+    };
+
+    for (unsigned int i = 0; i < sizeof(classes) / sizeof(classes[0]); i++)
+        if (strlen(classes[i].name) == len && !memcmp(classes[i].name, name, len)) {
+            for (unsigned int c = 1; c < 256; c++)
+                if (classes[i].func(c))
+                    set_byte(set, c);
+            return 0;
+        }
+    return -1;
+}
+
+/* parse bracket expression after '[' */
+static struct ast_t* parse_bracket(struct parse_t* const ps)
+{
+    uint64_t set[4] = {0, 0, 0, 0};
+    int negate = 0, first = 1;
+    struct ast_t *node;
+
+    if (*ps->p == '^') {
+        negate = 1;
+        ps->p++;
+    }
+    for (;; first = 0) {
+        unsigned int lo, hi;
+
+        if (!*ps->p) {
+            ps->bad = 1;
+            return NULL;
+        }
+        if (*ps->p == ']' && !first) {
+            ps->p++;
+            break;
+        }
+        if (ps->p[0] == '[' && ps->p[1] == ':') {
+            const char *const name = (const char*)ps->p + 2;
+            const char *const end = strstr(name, ":]");
+            if (!end || named_class(name, end - name, set)) {
+                ps->bad = 1;
+                return NULL;
+            }
+            ps->p = (const unsigned char*)end + 2;
+            continue;
+        }
+        // collating elements and equivalence classes
+        if (ps->p[0] == '[' && (ps->p[1] == '.' || ps->p[1] == '=')) {
+            ps->bad = 1;
+            return NULL;
+        }
+        lo = hi = *ps->p++;
+        if (ps->p[0] == '-' && ps->p[1] && ps->p[1] != ']') {
+            if (ps->p[1] == '[') {
+                ps->bad = 1;
+                return NULL;
+            }
+            hi = ps->p[1];
+            ps->p += 2;
+            // glibc folds ranges crossing letter case in its own way
+            if (hi < lo || (ps->icase && !((islower(lo) && islower(hi)) ||
+                                           (isupper(lo) && isupper(hi)) ||
+                                           (!isalpha(lo) && !isalpha(hi) &&
+                                            (hi < 'A' || lo > 'z'))))) {
+                ps->bad = 1;
+                return NULL;
+            }
+        }
+        for (unsigned int c = lo; c <= hi; c++)
+            set_byte(set, c);
+    }
+
+    if (ps->icase)
+        fold_class(set);
+    if (negate)
+        for (unsigned int i = 0; i < 4; i++)
+            set[i] = ~set[i];
+    // NUL never appears in names
+    set[0] &= ~1ULL;
+
+    node = new_node(A_CLASS, NULL, NULL);
+    node->cls = new_class(set);
+    return node;
+}
+
+static struct ast_t* parse_alt(struct parse_t* const ps);
+
+/* parse atom */
+static struct ast_t* parse_atom(struct parse_t* const ps)
+{
+    uint64_t set[4] = {0, 0, 0, 0};
+    struct ast_t *node;
+    unsigned int c = *ps->p++;
+
+    switch (c) {
+        case '(':
+            node = parse_alt(ps);
+            if (ps->bad || *ps->p != ')') {
+                ps->bad = 1;
+                free_ast(node);
+                return NULL;
+            }
+            ps->p++;
+            return node;
+        case '[':
+            return parse_bracket(ps);
+        case '^':
+            return new_node(A_BOL, NULL, NULL);
+        case '$':
+            return new_node(A_EOL, NULL, NULL);
+        case '.':
+            memset(set, 0xff, sizeof(set));
+            set[0] &= ~1ULL;
+            break;
+        case '\\':
+            c = *ps->p++;
+            // only escaped special characters, GNU escapes are left to regexec()
+            if (!c || !strchr(".[]()*+?{}|^$\\", c)) {
+                ps->bad = 1;
+                return NULL;
+            }
+            set_byte(set, c);
+            break;
+        case '*': case '+': case '?': case '{': case '|': case ')':
+            ps->bad = 1;
+            return NULL;
+        default:
+            set_byte(set, c);
+            break;
+    }
+    if (ps->icase)
+        fold_class(set);
+    node = new_node(A_CLASS, NULL, NULL);
+    node->cls = new_class(set);
+    return node;
+}
+
+/* parse bound of interval expression */
+static int parse_bound(struct parse_t* const ps)
+{
+    int n = 0;
+
+    if (!isdigit(*ps->p))
+        return -1;
+    while (isdigit(*ps->p)) {
+        n = n * 10 + (*ps->p++ - '0');
+        if (n > MAX_REPEAT)
+            return -1;
+    }
+    return n;
+}
+
+/* parse atom with its quantifiers */
+static struct ast_t* parse_piece(struct parse_t* const ps)
+{
+    struct ast_t *node = parse_atom(ps), *rep;
+
+    while (!ps->bad && *ps->p && strchr("*+?{", *ps->p)) {
+        int min, max;
+
+        // repeated anchors are left to regexec()
+        if (node->type == A_BOL || node->type == A_EOL) {
+            ps->bad = 1;
+            break;
+        }
+        switch (*ps->p++) {
+            case '*': min = 0; max = -1; break;
+            case '+': min = 1; max = -1; break;
+            case '?': min = 0; max = 1;  break;
+            default:
+                if ((min = parse_bound(ps)) < 0) {
+                    ps->bad = 1;
+                    break;
+                }
+                max = min;
+                if (*ps->p == ',') {
+                    ps->p++;
+                    max = (*ps->p == '}') ? -1 : parse_bound(ps);
+                    if (max == -1 && *ps->p != '}')
+                        ps->bad = 1;
+                }
+                if (*ps->p++ != '}' || (max >= 0 && max < min))
+                    ps->bad = 1;
+                break;
+        }
+        if (ps->bad)
+            break;
+        rep = new_node(A_REPEAT, node, NULL);
+        rep->min = min;
+        rep->max = max;
+        node = rep;
+    }
+    if (ps->bad) {
+        free_ast(node);
+        return NULL;
+    }
+    return node;
+}
+
+/* parse concatenation of pieces, empty one is left to regexec() */
+static struct ast_t* parse_cat(struct parse_t* const ps)
+{
+    struct ast_t *node = NULL, *piece;
+
+    while (*ps->p && *ps->p != '|' && *ps->p != ')') {
+        if (!(piece = parse_piece(ps))) {
+            free_ast(node);
+            return NULL;
+        }
+        node = node ? new_node(A_CAT, node, piece) : piece;
+    }
+    if (!node)
+        ps->bad = 1;
+    return node;
+}
+
+/* parse alternation */
+static struct ast_t* parse_alt(struct parse_t* const ps)
+{
+    struct ast_t *node = parse_cat(ps), *branch;
+
+    while (!ps->bad && *ps->p == '|') {
+        ps->p++;
+        if (!(branch = parse_cat(ps))) {
+            free_ast(node);
+            return NULL;
+        }
+        node = new_node(A_ALT, node, branch);
+    }
+    return node;
+}
+
+/* add NFA state */
+static unsigned int new_state(const int type, const unsigned int arg,
+                              const unsigned int out, const unsigned int out1)
+{
+    if (nfa.count == nfa.alloc) {
+        nfa.alloc = nfa.alloc ? nfa.alloc * 2 : 256;
+        nfa.state = xrealloc(nfa.state, sizeof(struct nstate_t) * nfa.alloc);
+    }
+    nfa.state[nfa.count].type = type;
+    nfa.state[nfa.count].arg = arg;
+    nfa.state[nfa.count].out = out;
+    nfa.state[nfa.count].out1 = out1;
+    return nfa.count++;
+}
+
+/* compile <node> followed by state <next>, return its start state;
+   <limit> is the last state number allowed for this pattern */
+static unsigned int compile(const struct ast_t* const node, const unsigned int next,
+                            const unsigned int limit, int* const bad)
+{
+    unsigned int cur, loop, body;
+    int n;                  //repeat counts are signed, max < 0 is unbounded
+
+    if (*bad || nfa.count > limit) {
+        *bad = 1;
+        return next;
+    }
+    switch (node->type) {
+        case A_CLASS:
+            return new_state(N_CHAR, node->cls, next, 0);
+        case A_BOL:
+            return new_state(N_BOL, 0, next, 0);
+        case A_EOL:
+            return new_state(N_EOL, 0, next, 0);
+        case A_CAT:
+            return compile(node->l, compile(node->r, next, limit, bad), limit, bad);
+        case A_ALT:
+            cur = compile(node->l, next, limit, bad);
+            return new_state(N_SPLIT, 0, cur, compile(node->r, next, limit, bad));
+        case A_REPEAT:
+            if (node->max < 0) {
+                // the loop state is patched to the body afterwards
+                loop = cur = new_state(N_SPLIT, 0, 0, next);
+                // compiling the body may move nfa.state, index it afterwards
+                body = compile(node->l, loop, limit, bad);
+                nfa.state[loop].out = body;
+            }
+            else
+                // optional copies of a bounded repeat
+                for (cur = next, n = node->min; n < node->max; n++)
+                    cur = new_state(N_SPLIT, 0, compile(node->l, cur, limit, bad), next);
+            for (n = 0; n < node->min; n++)
+                cur = compile(node->l, cur, limit, bad);
+            return cur;
+    }
+    return next;
+}
+
+/* split bytes into classes which are never distinguished by patterns */
+static void build_eq()
+{
+    unsigned char map[512];
+
+    memset(nfa.eq, 0, sizeof(nfa.eq));
+    nfa.neq = 1;
+    for (unsigned int i = 0; i < nfa.ncls; i++) {
+        unsigned int neq = 0;
+        memset(map, 0xff, sizeof(map));
+        for (unsigned int c = 0; c < 256; c++) {
+            const unsigned int key = nfa.eq[c] * 2 + has_byte(nfa.cls[i], c);
+            if (map[key] == 0xff)
+                map[key] = neq++;
+            nfa.eq[c] = map[key];
+        }
+        nfa.neq = neq;
+    }
+    for (int c = 255; c >= 0; c--)
+        nfa.rep[nfa.eq[c]] = c;
+}
+
+/********************************************************************
+ *                           PREFILTER                              *
+ ********************************************************************/
+
+/* Most patterns contain literals, anchors or length limits which are
+ * much cheaper to check than running the automaton. Conditions below
+ * are necessary only, a name passed them is still matched for real. */
+
+/* get literal character of class <cls>, lowercase if <icase>
+   -1 == class is not a single character */
+static int literal_char(const unsigned int cls, const int icase)
+{
+    int c = -1, count = 0;
+
+    for (unsigned int i = 0; i < 256; i++)
+        if (has_byte(nfa.cls[cls], i)) {
+            if (++count > 2)
+                return -1;
+            if (c < 0)
+                c = i;
+        }
+    if (count == 1 && (!icase || !isalpha(c)))
+        return c;
+    // case insensitive letter
+    if (count == 2 && icase && isupper(c) && has_byte(nfa.cls[cls], tolower(c)))
+        return tolower(c);
+    return -1;
+}
+
+/* flatten concatenation <node> into <seq> of <*n> nodes */
+static void flatten(const struct ast_t* const node, const struct ast_t*** const seq,
+                    unsigned int* const n, unsigned int* const alloc)
+{
+    if (node->type == A_CAT) {
+        flatten(node->l, seq, n, alloc);
+        flatten(node->r, seq, n, alloc);
+        return;
+    }
+    if (*n == *alloc) {
+        *alloc = *alloc ? *alloc * 2 : 16;
+        *seq = xrealloc(*seq, sizeof(struct ast_t*) * *alloc);
+    }
+    (*seq)[(*n)++] = node;
+}
+
+/* keep the longer literal of <run> and <lit> in <lit> */
+static void keep_longer(const char* const run, const size_t len,
+                        char** const lit, size_t* const lit_len)
+{
+    if (len <= *lit_len)
+        return;
+    free(*lit);
+    *lit = xmalloc(len + 1);
+    memcpy(*lit, run, len);
+    (*lit)[len] = '\0';
+    *lit_len = len;
+}
+
+/* find the longest literal required by <node> */
+static void find_literal(const struct ast_t* const node, const int icase, char* const run,
+                         char** const lit, size_t* const lit_len)
+{
+    const struct ast_t **seq = NULL;
+    unsigned int n = 0, alloc = 0;
+    size_t len = 0;
+    int c;
+
+    // alternatives may have nothing in common
+    if (node->type == A_ALT)
+        return;
+    flatten(node, &seq, &n, &alloc);
+    for (unsigned int i = 0; i < n; i++) {
+        if (seq[i]->type == A_CLASS && (c = literal_char(seq[i]->cls, icase)) >= 0) {
+            run[len++] = c;
+            continue;
+        }
+        keep_longer(run, len, lit, lit_len);
+        len = 0;
+        if (seq[i]->type == A_REPEAT && seq[i]->min > 0)
+            find_literal(seq[i]->l, icase, run, lit, lit_len);
+    }
+    keep_longer(run, len, lit, lit_len);
+    free(seq);
+}
+
+/* min and max length of text matched by <node>, max is SIZE_MAX if unbounded */
+static void match_len(const struct ast_t* const node, size_t* const min, size_t* const max)
+{
+    size_t lmin, lmax, rmin, rmax;
+
+    switch (node->type) {
+        case A_CLASS:
+            *min = *max = 1;
+            return;
+        case A_BOL:
+        case A_EOL:
+            *min = *max = 0;
+            return;
+        case A_CAT:
+        case A_ALT:
+            match_len(node->l, &lmin, &lmax);
+            match_len(node->r, &rmin, &rmax);
+            if (node->type == A_CAT) {
+                *min = lmin + rmin;
+                *max = (lmax == SIZE_MAX || rmax == SIZE_MAX) ? SIZE_MAX : lmax + rmax;
+            }
+            else {
+                *min = (lmin < rmin) ? lmin : rmin;
+                *max = (lmax > rmax) ? lmax : rmax;
+            }
+            return;
+        case A_REPEAT:
+            match_len(node->l, &lmin, &lmax);
+            *min = lmin * node->min;
+            *max = (node->max < 0 || lmax == SIZE_MAX) ? (lmax ? SIZE_MAX : 0)
+                                                       : lmax * node->max;
+            return;
+    }
+}
+
+/* extract prefilter of pattern <ast> into <f> */
+static void make_filter(const struct ast_t* const ast, const size_t pattern_len,
+                        const int icase, struct filter_t* const f)
+{
+    const struct ast_t **seq = NULL;
+    unsigned int n = 0, alloc = 0;
+    char *const run = xmalloc(pattern_len + 1);
+    int c;
+
+    memset(f, 0, sizeof(*f));
+    match_len(ast, &f->min_len, &f->max_len);
+    find_literal(ast, icase, run, &f->lit, &f->lit_len);
+
+    flatten(ast, &seq, &n, &alloc);
+    // the length of unanchored match says nothing about name length
+    if (seq[0]->type != A_BOL || seq[n - 1]->type != A_EOL)
+        f->max_len = SIZE_MAX;
+    if (seq[0]->type == A_BOL) {
+        size_t len = 0;
+        for (unsigned int i = 1; i < n && seq[i]->type == A_CLASS &&
+                                 (c = literal_char(seq[i]->cls, icase)) >= 0; i++)
+            run[len++] = c;
+        keep_longer(run, len, &f->prefix, &f->prefix_len);
+        // required literal is the prefix itself
+        if (f->prefix_len >= f->lit_len) {
+            free(f->lit);
+            f->lit = NULL;
+            f->lit_len = 0;
+        }
+    }
+    free(seq);
+    free(run);
+}
+
+/* check prefilter of pattern <i> for <name> of <len>
+   1 == name may match
+   0 == name can't match */
+static inline int filter_pass(const unsigned int i, const char* const name, const size_t len)
+{
+    const struct filter_t *const f = &nfa.filter[i];
+
+    if (len < f->min_len || len > f->max_len)
+        return 0;
+    if (opt.re & REG_ICASE)
+        return (!f->prefix_len || !strncasecmp(name, f->prefix, f->prefix_len)) &&
+               (!f->lit_len || strcasestr(name, f->lit));
+    return (!f->prefix_len || !memcmp(name, f->prefix, f->prefix_len)) &&
+           (!f->lit_len || memmem(name, len, f->lit, f->lit_len));
+}
+
+/********************************************************************
+ *                            COMPILER                              *
+ ********************************************************************/
+
+void mregex_compile()
+{
+    nfa.words = (symbol.size + 63) / 64;
+    nfa.start = xmalloc(sizeof(unsigned int) * symbol.size);
+    nfa.pattern = xmalloc(sizeof(unsigned int) * symbol.size);
+    nfa.fallback = xmalloc(sizeof(unsigned int) * symbol.size);
+    nfa.filter = xcalloc(symbol.size, sizeof(struct filter_t));
+
+    for (unsigned int i = 0; i < symbol.size; i++) {
+        struct parse_t ps = {(const unsigned char*)symbol.str[i],
+                             (opt.re & REG_ICASE) != 0, 0};
+        const unsigned int count = nfa.count, ncls = nfa.ncls;
+        struct ast_t *const ast = parse_alt(&ps);
+
+        if (!ps.bad && *ps.p)
+            ps.bad = 1;
+        if (!ps.bad)
+            make_filter(ast, strlen(symbol.str[i]), ps.icase, &nfa.filter[i]);
+        else
+            nfa.filter[i].max_len = SIZE_MAX;
+        if (!ps.bad) {
+            const unsigned int match = new_state(N_MATCH, i, 0, 0);
+            const unsigned int start = compile(ast, match, count + MAX_NFA, &ps.bad);
+            if (!ps.bad) {
+                nfa.pattern[nfa.nstart] = i;
+                nfa.start[nfa.nstart++] = start;
+            }
+        }
+        free_ast(ast);
+        if (ps.bad) {
+            // drop partial automaton
+            nfa.count = count;
+            nfa.ncls = ncls;
+            nfa.fallback[nfa.nfallback++] = i;
+        }
+    }
+    build_eq();
+
+    // a few patterns are rejected by prefilters faster than by DFA
+    nfa.dfa_filter = nfa.nstart && nfa.nstart <= MAX_DFA_FILTER;
+    for (unsigned int i = 0; i < nfa.nstart; i++) {
+        const struct filter_t *const f = &nfa.filter[nfa.pattern[i]];
+        if (!f->prefix_len && !f->lit_len)
+            nfa.dfa_filter = 0;
+    }
+
+    // every pattern must require a literal for string table search
+    if (!(opt.re & REG_ICASE) && symbol.size <= MAX_LITERALS)
+        for (unsigned int i = 0; i < symbol.size; i++) {
+            const struct filter_t *const f = &nfa.filter[i];
+            if (!f->lit_len && !f->prefix_len) {
+                nfa.nlit = 0;
+                break;
+            }
+            nfa.lit[nfa.nlit] = (f->lit_len) ? f->lit : f->prefix;
+            nfa.lit_len[nfa.nlit++] = (f->lit_len) ? f->lit_len : f->prefix_len;
+        }
+    pthread_key_create(&dfa_key, free_dfa);
+}
+
+unsigned int mregex_literals(const char* const** const lit, const size_t** const len)
+{
+    if (lit)
+        *lit = nfa.lit;
+    if (len)
+        *len = nfa.lit_len;
+    return nfa.nlit;
+}
+
+const char* mregex_prefix(const unsigned int i, size_t* const len)
+{
+    // folded prefix doesn't bound names in byte order
+    if ((opt.re & REG_ICASE) || !nfa.filter[i].prefix_len)
+        return NULL;
+    *len = nfa.filter[i].prefix_len;
+    return nfa.filter[i].prefix;
+}
+
+/********************************************************************
+ *                               DFA                                *
+ ********************************************************************/
+
+/* compute closure of <n> states in <from>, following '^' if <bol>;
+   the sorted result is stored in dfa->buf, its size is returned */
+static unsigned int closure(struct dfa_t* const dfa, const unsigned int* const from,
+                            const unsigned int n, const int bol)
+{
+    unsigned int sp = 0, count = 0;
+
+    if (!++dfa->gen) {
+        memset(dfa->mark, 0, sizeof(unsigned int) * nfa.count);
+        dfa->gen = 1;
+    }
+    for (unsigned int i = n; i--; )
+        dfa->stack[sp++] = from[i];
+
+    while (sp) {
+        const unsigned int s = dfa->stack[--sp];
+        const struct nstate_t *const st = &nfa.state[s];
+
+        if (dfa->mark[s] == dfa->gen)
+            continue;
+        dfa->mark[s] = dfa->gen;
+        switch (st->type) {
+            case N_SPLIT:
+                dfa->stack[sp++] = st->out1;
+                dfa->stack[sp++] = st->out;
+                break;
+            case N_BOL:
+                if (bol)
+                    dfa->stack[sp++] = st->out;
+                break;
+            default:
+                dfa->buf[count++] = s;
+                break;
+        }
+    }
+
+    // sort states for unique representation, sets are usually small
+    for (unsigned int i = 1; i < count; i++) {
+        const unsigned int s = dfa->buf[i];
+        unsigned int j = i;
+        for (; j && dfa->buf[j - 1] > s; j--)
+            dfa->buf[j] = dfa->buf[j - 1];
+        dfa->buf[j] = s;
+    }
+    return count;
+}
+
+/* collect patterns matched at the end of name in state set <set> of <n>
+   into dfa->buf, return their number */
+static unsigned int end_matches(struct dfa_t* const dfa, const unsigned int* const set,
+                                const unsigned int n)
+{
+    unsigned int sp = 0, count = 0;
+
+    if (!++dfa->gen) {
+        memset(dfa->mark, 0, sizeof(unsigned int) * nfa.count);
+        dfa->gen = 1;
+    }
+    for (unsigned int i = 0; i < n; i++)
+        if (nfa.state[set[i]].type == N_EOL)
+            dfa->stack[sp++] = nfa.state[set[i]].out;
+
+    while (sp) {
+        const unsigned int s = dfa->stack[--sp];
+        const struct nstate_t *const st = &nfa.state[s];
+
+        if (dfa->mark[s] == dfa->gen)
+            continue;
+        dfa->mark[s] = dfa->gen;
+        switch (st->type) {
+            case N_SPLIT:
+                dfa->stack[sp++] = st->out1;
+                dfa->stack[sp++] = st->out;
+                break;
+            case N_EOL:
+                dfa->stack[sp++] = st->out;
+                break;
+            case N_MATCH:
+                dfa->buf[count++] = st->arg;
+                break;
+        }
+    }
+    return count;
+}
+
+static uint32_t hash_set(const unsigned int* const set, const unsigned int n)
+{
+    uint32_t h = 2166136261U;
+    for (unsigned int i = 0; i < n; i++)
+        h = (h ^ set[i]) * 16777619U;
+    return h;
+}
+
+/* drop all cached states */
+static void flush_dfa(struct dfa_t* const dfa)
+{
+    for (unsigned int i = 0; i < dfa->hsize; i++)
+        for (struct dstate_t *d = dfa->htab[i], *next; d; d = next) {
+            next = d->hnext;
+            free(d->set);
+            free(d->acc);
+            free(d);
+        }
+    memset(dfa->htab, 0, sizeof(struct dstate_t*) * dfa->hsize);
+    dfa->count = 0;
+    dfa->mem = 0;
+    dfa->start = NULL;
+}
+
+/* find or create state of <n> NFA states in dfa->buf */
+static struct dstate_t* get_state(struct dfa_t* const dfa, const unsigned int n)
+{
+    const uint32_t h = hash_set(dfa->buf, n);
+    struct dstate_t *d;
+    unsigned int *set, nacc = 0;
+
+    for (d = dfa->htab[h % dfa->hsize]; d; d = d->hnext)
+        if (d->hash == h && d->n == n && !memcmp(d->set, dfa->buf, sizeof(unsigned int) * n))
+            return d;
+
+    d = xcalloc(1, sizeof(struct dstate_t) + sizeof(struct dstate_t*) * nfa.neq);
+    set = xmalloc(sizeof(unsigned int) * (n ? n : 1));
+    memcpy(set, dfa->buf, sizeof(unsigned int) * n);
+    d->set = set;
+    d->n = n;
+    d->hash = h;
+
+    for (unsigned int i = 0; i < n; i++)
+        if (nfa.state[set[i]].type == N_MATCH)
+            nacc++;
+    d->nacc_end = end_matches(dfa, set, n);
+    d->acc = xmalloc(sizeof(unsigned int) * (nacc + d->nacc_end + 1));
+    d->acc_end = d->acc + nacc;
+    memcpy(d->acc_end, dfa->buf, sizeof(unsigned int) * d->nacc_end);
+    for (unsigned int i = 0; i < n; i++)
+        if (nfa.state[set[i]].type == N_MATCH)
+            d->acc[d->nacc++] = nfa.state[set[i]].arg;
+
+    d->hnext = dfa->htab[h % dfa->hsize];
+    dfa->htab[h % dfa->hsize] = d;
+    dfa->count++;
+    dfa->mem += sizeof(struct dstate_t) + sizeof(struct dstate_t*) * nfa.neq +
+                sizeof(unsigned int) * (n + nacc + d->nacc_end + 1);
+    return d;
+}
+
+/* state at the beginning of name */
+static struct dstate_t* start_state(struct dfa_t* const dfa)
+{
+    if (!dfa->start)
+        dfa->start = get_state(dfa, closure(dfa, nfa.start, nfa.nstart, 1));
+    return dfa->start;
+}
+
+/* transition of state <d> by byte <c> */
+static struct dstate_t* step(struct dfa_t* const dfa, struct dstate_t* d, const unsigned char c)
+{
+    const unsigned int e = nfa.eq[c];
+    unsigned int n = 0;
+
+    if (d->next[e])
+        return d->next[e];
+
+    // keep the current state over cache flush
+    if (dfa->count >= MAX_DFA || dfa->mem >= MAX_DFA_MEM) {
+        unsigned int *const set = d->set, count = d->n;
+        d->set = NULL;
+        flush_dfa(dfa);
+        memcpy(dfa->buf, set, sizeof(unsigned int) * count);
+        free(set);
+        d = get_state(dfa, count);
+    }
+
+    for (unsigned int i = 0; i < d->n; i++) {
+        const struct nstate_t *const st = &nfa.state[d->set[i]];
+        if (st->type == N_CHAR && has_byte(nfa.cls[st->arg], nfa.rep[e]))
+            dfa->moves[n++] = st->out;
+    }
+    // unanchored search: patterns may start at any position
+    memcpy(dfa->moves + n, nfa.start, sizeof(unsigned int) * nfa.nstart);
+    n += nfa.nstart;
+
+    return d->next[e] = get_state(dfa, closure(dfa, dfa->moves, n, 0));
+}
+
+/* get DFA cache of the calling thread */
+static struct dfa_t* thread_dfa()
+{
+    struct dfa_t *dfa = pthread_getspecific(dfa_key);
+
+    if (!dfa) {
+        dfa = xcalloc(1, sizeof(struct dfa_t));
+        dfa->hsize = 4096;
+        dfa->htab = xcalloc(dfa->hsize, sizeof(struct dstate_t*));
+        dfa->mark = xcalloc(nfa.count + 1, sizeof(unsigned int));
+        dfa->stack = xmalloc(sizeof(unsigned int) * (nfa.count * 3 + nfa.nstart + 1));
+        dfa->buf = xmalloc(sizeof(unsigned int) * (nfa.count + 1));
+        dfa->moves = xmalloc(sizeof(unsigned int) * (nfa.count + nfa.nstart + 1));
+        dfa->result = xmalloc(sizeof(uint64_t) * (nfa.words + 1));
+        pthread_setspecific(dfa_key, dfa);
+    }
+    return dfa;
+}
+
+const uint64_t* mregex_exec(const char* const name)
+{
+    struct dfa_t *const dfa = thread_dfa();
+    const size_t len = strlen(name);
+    int any = 0, run = nfa.nstart && len;
+
+    memset(dfa->result, 0, sizeof(uint64_t) * nfa.words);
+
+    if (run && nfa.dfa_filter) {
+        run = 0;
+        for (unsigned int i = 0; i < nfa.nstart && !run; i++)
+            run = filter_pass(nfa.pattern[i], name, len);
+    }
+    if (run) {
+        struct dstate_t *d = start_state(dfa);
+        for (const unsigned char *p = (const unsigned char*)name; ; p++) {
+            for (unsigned int i = 0; i < d->nacc; i++) {
+                dfa->result[d->acc[i] >> 6] |= 1ULL << (d->acc[i] & 63);
+                any = 1;
+            }
+            if (!*p)
+                break;
+            d = step(dfa, d, *p);
+        }
+        for (unsigned int i = 0; i < d->nacc_end; i++) {
+            dfa->result[d->acc_end[i] >> 6] |= 1ULL << (d->acc_end[i] & 63);
+            any = 1;
+        }
+    }
+
+    // '^' after '$' holds for empty name only, this is not worth a special state
+    for (unsigned int j = 0, n = (*name) ? nfa.nfallback : symbol.size; j < n; j++) {
+        const unsigned int i = (*name) ? nfa.fallback[j] : j;
+        if (*name && !filter_pass(i, name, len))
+            continue;
+        const int res_code = regexec(&symbol.regstr[i], name, 0, NULL, 0);
+        switch (res_code) {
+            case REG_NOMATCH:
+                break;
+            case 0:
+                dfa->result[i >> 6] |= 1ULL << (i & 63);
+                any = 1;
+                break;
+            default:
+                if (opt.verb) {
+                    // reg_error_str is shared, don't garble it
+                    char buf[256];
+                    regerror(res_code, &symbol.regstr[i], buf, sizeof(buf));
+                    error(0, errno, "warning: can't execute regular expression '%s': %s",
+                          symbol.str[i], buf);
+                }
+                break;
+        }
+    }
+
+    return (any) ? dfa->result : NULL;
+}
+
+/* free DFA cache <arg>, called on thread exit too */
+static void free_dfa(void* const arg)
+{
+    struct dfa_t *const dfa = arg;
+
+    if (!dfa)
+        return;
+    flush_dfa(dfa);
+    free(dfa->htab);
+    free(dfa->mark);
+    free(dfa->stack);
+    free(dfa->buf);
+    free(dfa->moves);
+    free(dfa->result);
+    free(dfa);
+}
+
+void mregex_free()
+{
+    if (!nfa.start)
+        return;
+    free_dfa(pthread_getspecific(dfa_key));
+    pthread_key_delete(dfa_key);
+    free(nfa.state);
+    free(nfa.cls);
+    free(nfa.start);
+    free(nfa.pattern);
+    for (unsigned int i = 0; i < symbol.size; i++) {
+        free(nfa.filter[i].prefix);
+        free(nfa.filter[i].lit);
+    }
+    free(nfa.filter);
+    free(nfa.fallback);
+    memset(&nfa, 0, sizeof(nfa));
+}
@@ -0,0 +1,49 @@
+/*
+ *  Multi-pattern regular expression matching
+ *  Copyright © 2007-2011 Andrew Savchenko
+ *
+ *  This file is part of symlookup.
+ *
+ *  symlookup is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 3 as
+ *  published by the Free Software Foundation
+ *
+ *  symlookup is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License version 3 for more details.
+ *
+ *  You should have received a copy of the GNU General Public License version 3
+ *  along with symlookup. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SL_MREGEX_H
+#define SL_MREGEX_H
+
+#include <stdint.h>
+
+/* compile all user regular expressions into a single automaton,
+   symbol.regstr must be already compiled */
+void mregex_compile();
+
+/* match <name> against all user regular expressions at once
+   NULL == nothing matched
+   otherwise bitset of matched pattern indexes,
+   valid until the next call in the same thread */
+const uint64_t* mregex_exec(const char* const name);
+
+/* get literals one of which is contained in every name matched
+   by any user regular expression, to search string tables in bulk
+   0 == there are no such literals
+   otherwise number of literals stored to <lit> and <len>, if not NULL */
+unsigned int mregex_literals(const char* const** const lit, const size_t** const len);
+
+/* get literal prefix of every name matched by pattern <i>, its length
+   is stored to <len>
+   NULL == there is no such prefix or case is ignored */
+const char* mregex_prefix(const unsigned int i, size_t* const len);
+
+/* free automaton */
+void mregex_free();
+
+#endif /* SL_MREGEX_H */
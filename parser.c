@@ -30,12 +30,17 @@
 #include <getopt.h>
 #include <regex.h>
 #include <glob.h>
+#include <unistd.h>
 
 #include "symlookup.h"
 #include "safemem.h"
 #include "parser.h"
 #include "version.h"
 #include "rpmutils.h"
+#include "scanelf.h"
+#include "mregex.h"
+#include "ldcache.h"
+#include "closure.h"
 
 extern struct str_t sp; //all search pathes (string array)
 
@@ -52,27 +57,183 @@ unsigned int filename_case = 0;
 // set for already added fields
 unsigned int field_set = 0;
 
-/* grow symbol array by adding new element <str> */
+/* Convert shell wildcard pattern <glob> to anchored extended regular
+   expression: '*' and '?' match any string and character, brackets
+   are kept ('!' negates them too), everything else is literal.
+   The result must be freed. */
+static char* glob_to_ere(const char* const glob)
+{
+    // each character takes two at most, anchors and '\0' are added
+    char *const re = xmalloc(strlen(glob) * 2 + 3);
+    char *r = re;
+
+    *r++ = '^';
+    for (const char *p = glob; *p; p++) {
+        if (*p == '*') {
+            *r++ = '.';
+            *r++ = '*';
+            continue;
+        }
+        if (*p == '?') {
+            *r++ = '.';
+            continue;
+        }
+        if (*p == '[') {
+            const char *end = p + 1;
+            if (*end == '!' || *end == '^')
+                end++;
+            // leading ']' is a member of the bracket
+            if (*end == ']')
+                end++;
+            end = strchr(end, ']');
+            if (end) {
+                *r++ = *p++;
+                if (*p == '!' || *p == '^') {
+                    *r++ = '^';
+                    p++;
+                }
+                memcpy(r, p, end - p + 1);
+                r += end - p + 1;
+                p = end;
+                continue;
+            }
+            // unmatched bracket is a literal
+        }
+        else if (*p == '\\' && p[1])
+            p++;
+        if (strchr(".[]()*+?{}|^$\\", *p))
+            *r++ = '\\';
+        *r++ = *p;
+    }
+    *r++ = '$';
+    *r = '\0';
+    return re;
+}
+
+/* grow symbol array by adding new element <str>;
+   arrays grow geometrically, thousands of symbols are usual for
+   --undefined-of and stdin */
 static void grow_sym(const char* const str)
 {
-    add_str(&symbol.str, symbol.size, str);
+    static unsigned int alloc = 0;  //number of allocated elements
+
+    if (symbol.size == alloc) {
+        alloc = (alloc) ? alloc * 2 : 16;
+        symbol.str = xrealloc(symbol.str, sizeof(char*) * alloc);
+        if (opt.re)
+            symbol.regstr = xrealloc(symbol.regstr, sizeof(regex_t) * alloc);
+        else {
+            symbol.gnu_hash = xrealloc(symbol.gnu_hash, sizeof(uint32_t) * alloc);
+            symbol.len = xrealloc(symbol.len, sizeof(size_t) * alloc);
+            if (!opt.cas)
+                symbol.hash = xrealloc(symbol.hash, sizeof(uint32_t) * alloc);
+        }
+    }
 
-    /* allocate memory for regular expression and create it */
+    if (opt.glob)
+        symbol.str[symbol.size] = glob_to_ere(str);
+    else
+        symbol.str[symbol.size] = alloc_str(str);
+
+    /* create regular expression */
     if (opt.re) {
-        symbol.regstr = xrealloc(symbol.regstr, sizeof(regex_t) * (symbol.size + 1));
         int err_code;
         //compile regexp
-        if (( err_code = regcomp(&symbol.regstr[symbol.size], str, opt.re) ))
+        if (( err_code = regcomp(&symbol.regstr[symbol.size], symbol.str[symbol.size], opt.re) ))
         {
             regerror(err_code, &symbol.regstr[symbol.size], reg_error_str, reg_error_str_len);
             error(ERR_PARSE, errno, "failed to compile regular expression '%s': %s",
                   str, reg_error_str);
         }
     }
+    /* hash symbol once for hash set and ELF hash table lookups;
+       case insensitive symbols are hashed folded */
+    else {
+        if (opt.cas)
+            symbol.gnu_hash[symbol.size] = fold_hash_len(str, &symbol.len[symbol.size]);
+        else {
+            symbol.hash[symbol.size] = elf_sysv_hash(str);
+            symbol.gnu_hash[symbol.size] = elf_gnu_hash_len(str, &symbol.len[symbol.size]);
+        }
+    }
 
     ++symbol.size;      //+1 element
 }
 
+/* comparison function for exact symbols indexes, first by hash, then by name */
+static int compare_sym(const void* const a, const void* const b)
+{
+    const unsigned int x = *(const unsigned int*)a;
+    const unsigned int y = *(const unsigned int*)b;
+    int res;
+
+    if (symbol.gnu_hash[x] != symbol.gnu_hash[y])
+        return (symbol.gnu_hash[x] < symbol.gnu_hash[y]) ? -1 : 1;
+    if ((res = strcmp(symbol.str[x], symbol.str[y])))
+        return res;
+    return (x < y) ? -1 : 1;
+}
+
+/* Remove duplicated exact symbols, keeping the first occurrence of each.
+   Hash table lookups probe each requested symbol independently, so
+   duplicates would be reported several times otherwise. */
+static void uniq_sym()
+{
+    unsigned int *idx, *dup, j;
+
+    if (symbol.size < 2)
+        return;
+
+    idx = xmalloc(sizeof(unsigned int) * symbol.size);
+    dup = xcalloc(symbol.size, sizeof(unsigned int));
+    for (unsigned int i=0; i < symbol.size; i++)
+        idx[i] = i;
+    qsort(idx, symbol.size, sizeof(unsigned int), compare_sym);
+    // equal names are adjacent, the first one has the lowest index
+    for (unsigned int i=1; i < symbol.size; i++)
+        if (symbol.gnu_hash[idx[i]] == symbol.gnu_hash[idx[i-1]] &&
+            !strcmp(symbol.str[idx[i]], symbol.str[idx[i-1]]))
+            dup[idx[i]] = 1;
+
+    for (unsigned int i = j = 0; i < symbol.size; i++) {
+        if (dup[i]) {
+            free(symbol.str[i]);
+            continue;
+        }
+        symbol.str[j] = symbol.str[i];
+        symbol.hash[j] = symbol.hash[i];
+        symbol.gnu_hash[j] = symbol.gnu_hash[i];
+        symbol.len[j] = symbol.len[i];
+        j++;
+    }
+    symbol.size = j;
+
+    free(dup);
+    free(idx);
+}
+
+/* Build open addressing hash set of exact symbols, so each library
+   symbol costs a single probe whatever number of symbols is requested.
+   Set is kept at most half full. Exact symbols must be unique already,
+   case insensitive ones may differ in case only and are all probed:
+   equal keys are placed in ascending index order. */
+static void build_sym_set()
+{
+    unsigned int size = 2;
+
+    while (size < symbol.size * 2)
+        size *= 2;
+    symbol.set = xcalloc(size, sizeof(unsigned int));
+    symbol.set_mask = size - 1;
+
+    for (unsigned int i=0; i < symbol.size; i++) {
+        unsigned int slot = symbol.gnu_hash[i] & symbol.set_mask;
+        while (symbol.set[slot])
+            slot = (slot + 1) & symbol.set_mask;
+        symbol.set[slot] = i + 1;
+    }
+}
+
 /********************************************************************
  *                          SORTING UTILS                           *
  * * * * * * * * * * * * * * * * ** * * * * * * * * * * * * * * * * *
@@ -470,9 +631,9 @@ static void parse_path_str(char* const str)
         while ((tail = strtok(NULL, ":")));
 }
 
-static void parse_ld_so_conf (const char* const);
 /* parse include command in ld.so.conf */
-static void parse_ld_so_conf_include (const char* const filename, const char* pattern)
+static void parse_ld_so_conf_include (const char* const filename, const char* pattern,
+                                      struct str_t* const dirs)
 {
     char *newp = NULL;
     glob_t gl;
@@ -493,7 +654,7 @@ static void parse_ld_so_conf_include (const char* const filename, const char* pa
     switch (glob (pattern, GLOB_NOSORT, NULL, &gl)) {
         case 0:
             for (unsigned int i = 0; i < gl.gl_pathc; i++)
-                parse_ld_so_conf (gl.gl_pathv[i]);
+                parse_ld_so_conf (gl.gl_pathv[i], dirs);
             globfree (&gl);
             break;
         case GLOB_NOMATCH:
@@ -519,7 +680,7 @@ static void parse_ld_so_conf_include (const char* const filename, const char* pa
 }
 
 /* parse ld *.conf file */
-static void parse_ld_so_conf (const char* const filename)
+void parse_ld_so_conf (const char* const filename, struct str_t* const dirs)
 {
     FILE *fd = fopen (filename, "r");
     char *line,     // buffer for line
@@ -552,12 +713,12 @@ static void parse_ld_so_conf (const char* const filename)
         //check for "include" keyword
         if (!strcmp(tail, "include"))
             while ((tail = strtok_r(NULL, " \t", &tok_buf)))
-                parse_ld_so_conf_include (filename, tail);
+                parse_ld_so_conf_include (filename, tail, dirs);
         else {
             //allow '=' character in the same way as ld
             if (!strcmp(tail,"="))
                 tail = strtok_r(NULL, " \f\r\t\v", &tok_buf);
-            grow_str(&sp, tail);
+            grow_str(dirs, tail);
         }
     }
 
@@ -590,7 +751,7 @@ static inline void set_default_path()
     grow_str(&sp, "/usr/lib");
 
     /* process /etc/ld.so.conf */
-    parse_ld_so_conf("/etc/ld.so.conf");
+    parse_ld_so_conf(LD_SO_CONF, &sp);
 }
 
 /****************************************************************
@@ -666,8 +827,20 @@ void parse(const int argc, char* const argv[])
         {"noext",               no_argument,       NULL,'X'},
         {"regexp",              no_argument,       NULL,'r'},
         {"ignorecase",          no_argument,       NULL,'i'},
+        {"glob",                no_argument,       NULL,'g'},
         {"filename-regexp",     required_argument, NULL,'F'},
         {"filename-ignorecase", no_argument,       NULL,'I'},
+        {"jobs",                required_argument, NULL,'j'},
+        {"skip-cache",          required_argument, NULL,'C'},
+        {"ld-cache",            optional_argument, NULL,'L'},
+        {"for-binary",          required_argument, NULL,'B'},
+        {"undefined-of",        required_argument, NULL,'U'},
+        {"build-index",         required_argument, NULL,'b'},
+        {"index",               required_argument, NULL,'x'},
+        {"consumers",           no_argument,       NULL,'c'},
+#ifdef HAVE_IO_URING
+        {"io-uring",            no_argument,       NULL,'u'},
+#endif //HAVE_IO_URING
 #ifdef HAVE_RPM
         {"rpm",                 no_argument,       NULL,'R'},
         {"rpm-root",            required_argument, NULL,'z'},
@@ -690,7 +863,10 @@ void parse(const int argc, char* const argv[])
 
     do  /* reading options */
     {
-        c = getopt_long(argc, argv, "p:aAsdXriF:I"
+        c = getopt_long(argc, argv, "p:aAsdXrigF:Ij:C:L::"
+#ifdef HAVE_IO_URING
+                                    "u"
+#endif //HAVE_IO_URING
 #ifdef HAVE_RPM
                                     "R"
 #endif //HAVE_RPM
@@ -733,9 +909,36 @@ void parse(const int argc, char* const argv[])
             "    -r, --regexp                    treat given symbols as extended\n"
             "                                    regular expressions\n"
             "    -i, --ignorecase                ignore case in symbols\n"
+            "    -g, --glob                      treat given symbols as shell wildcard\n"
+            "                                    patterns, e.g. '_ZN3foo*'\n"
             "    -F, --filename-regexp           select only file names satisfying given\n"
             "                                    regular expression\n"
             "    -I, --filename-ignorecase       ignore case in filename reg. expression\n"
+            "    -j, --jobs <N>                  walk and scan in N threads, 0 stands for\n"
+            "                                    the number of online CPUs\n"
+            "    -C, --skip-cache <FILE>         remember files which are neither ELF\n"
+            "                                    nor ar in FILE and skip them next time\n"
+            "    -L, --ld-cache[=FILE]           scan only libraries listed in ld.so\n"
+            "                                    cache FILE (" LDCACHE_DEFAULT ")\n"
+            "                                    instead of walking search path\n"
+            "    --for-binary <FILE>             scan only FILE and libraries it is\n"
+            "                                    linked with, in the order ld.so(8)\n"
+            "                                    loads them; definitions the loader\n"
+            "                                    binds to are marked '(bound)'\n"
+            "    --undefined-of <FILE>           look up all symbols ELF object, archive\n"
+            "                                    or executable FILE imports, the ones\n"
+            "                                    not found are reported as <unresolved>\n"
+            "    --build-index <FILE>            scan as usual, but write all defined\n"
+            "                                    symbols to index FILE, refresh it if\n"
+            "                                    exists; no symbols are given here\n"
+            "    --index <FILE>                  look symbols up in index FILE instead\n"
+            "                                    of scanning\n"
+            "    --consumers                     find files which import given symbols\n"
+            "                                    instead of defining ones (with --index)\n"
+#ifdef HAVE_IO_URING
+            "    -u, --io-uring                  read files via io_uring, keeping many\n"
+            "                                    reads in flight (single thread only)\n"
+#endif //HAVE_IO_URING
 #ifdef HAVE_RPM
             "    -R, --rpm                       find rpms, containing target libs\n"
 #endif //HAVE_RPM
@@ -854,7 +1057,11 @@ void parse(const int argc, char* const argv[])
                 break;
             case 'i':
                 opt.cas = 1;
-                compare_func = strcasecmp;
+                break;
+            case 'g':
+                //wildcards are matched as regexps
+                opt.glob = 1;
+                opt.re = REG_EXTENDED | REG_NOSUB;
                 break;
             case 'F':
                 if (filename_regexp)
@@ -864,6 +1071,55 @@ void parse(const int argc, char* const argv[])
             case 'I':
                 filename_case = 1;
                 break;
+            case 'j':
+            {
+                char *end;
+                long jobs = strtol(optarg, &end, 10);
+                if (*end || end == optarg || jobs < 0 || jobs > 1024)
+                    error(ERR_PARSE, 0, "parse error: invalid number of jobs '%s'", optarg);
+                if (!jobs && (jobs = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+                    jobs = 1;
+                opt.jobs = jobs;
+                break;
+            }
+            case 'C':
+                if (opt.skipcache)
+                    free(opt.skipcache);
+                opt.skipcache = alloc_str(optarg);
+                break;
+            case 'L':
+                if (opt.ldcache)
+                    free(opt.ldcache);
+                opt.ldcache = alloc_str((optarg) ? optarg : LDCACHE_DEFAULT);
+                break;
+            case 'B':
+                if (opt.for_binary)
+                    free(opt.for_binary);
+                opt.for_binary = alloc_str(optarg);
+                break;
+            case 'U':
+                if (opt.undefined_of)
+                    free(opt.undefined_of);
+                opt.undefined_of = alloc_str(optarg);
+                break;
+            case 'b':
+                if (opt.build_index)
+                    free(opt.build_index);
+                opt.build_index = alloc_str(optarg);
+                break;
+            case 'x':
+                if (opt.index)
+                    free(opt.index);
+                opt.index = alloc_str(optarg);
+                break;
+            case 'c':
+                opt.consumers = 1;
+                break;
+#ifdef HAVE_IO_URING
+            case 'u':
+                opt.uring = 1;
+                break;
+#endif //HAVE_IO_URING
 #ifdef HAVE_RPM
             case 'R':
                 opt.rpm = 1;
@@ -929,8 +1185,33 @@ void parse(const int argc, char* const argv[])
         opt.hdr=0;
     }
 
+    if (opt.for_binary && (opt.index || opt.build_index))
+        error(ERR_PARSE, 0, "parse error: --for-binary can't be used with an index");
+    // libraries of the binary are scanned sequentially in load order,
+    // so the first match of a symbol is its bound definition
+    if (opt.for_binary) {
+        if (sp.size || opt.ldcache)
+            error(ERR_PARSE, 0, "parse error: --for-binary can't be used with -p or --ld-cache");
+        closure_load();
+        opt.dp = 0;
+        opt.ext = 0;
+        opt.jobs = 1;
+#ifdef HAVE_IO_URING
+        opt.uring = 0;
+#endif //HAVE_IO_URING
+        opt.fts |= FTS_COMFOLLOW;
+    }
+    // libraries known to the dynamic linker are scanned directly
+    else if (opt.ldcache) {
+        if (sp.size)
+            error(ERR_PARSE, 0, "parse error: -p and --ld-cache can't be used together");
+        ldcache_load();
+        opt.dp = 0;
+        // cached paths are mostly symbolic links to the libraries
+        opt.fts |= FTS_COMFOLLOW;
+    }
     // user didn't define search paths
-    if (!sp.size)
+    else if (!sp.size)
         set_default_path();
     else
         opt.dp = 0;
@@ -965,8 +1246,27 @@ void parse(const int argc, char* const argv[])
         }
     }
 
+    if (opt.build_index && opt.index)
+        error(ERR_PARSE, 0, "parse error: --build-index and --index can't be used together");
+    if (opt.consumers && !opt.index)
+        error(ERR_PARSE, 0, "parse error: --consumers can be used with --index only");
+    if (opt.undefined_of && (opt.re || opt.build_index || opt.consumers))
+        error(ERR_PARSE, 0, "parse error: --undefined-of can't be used with -r, -g, "
+                            "--build-index or --consumers");
+
+    /* all symbols are collected to index */
+    if (opt.build_index) {
+        if (optind < argc)
+            error(ERR_PARSE, 0, "parse error: symbols can't be given with --build-index");
+    }
+    /* symbols are read from the file */
+    else if (opt.undefined_of) {
+        if (optind < argc)
+            error(ERR_PARSE, 0, "parse error: symbols can't be given with --undefined-of");
+        undefined_of(opt.undefined_of, grow_sym);
+    }
     /* read from stdin if no symbols are specified */
-    if (optind == argc) {
+    else if (optind == argc) {
         char *line = xmalloc(line_buf);
         /* read whole line from stdin */
         while (getline(&line, &line_buf, stdin) != -1)
@@ -986,6 +1286,14 @@ void parse(const int argc, char* const argv[])
         while (optind < argc)
             grow_sym(argv[optind++]);
 
+    if (!opt.re && !opt.build_index) {
+        if (!opt.cas)
+            uniq_sym();
+        build_sym_set();
+    }
+    if (opt.re && !opt.build_index)
+        mregex_compile();
+
 #if (defined(HAVE_RPM) || defined(HAVE_PORTAGE))
     init_packages();
 #endif //(defined(HAVE_RPM) || defined(HAVE_PORTAGE))
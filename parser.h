@@ -20,6 +20,15 @@
 #ifndef SL_PARSER_H
 #define SL_PARSER_H
 
+/* system configuration of the dynamic linker */
+#define LD_SO_CONF "/etc/ld.so.conf"
+
+struct str_t;
+
 void parse(const int, char* const []);
 
+/* add directories listed in ld.so.conf <filename> and files included
+   by it to <dirs> */
+void parse_ld_so_conf(const char* const filename, struct str_t* const dirs);
+
 #endif /* SL_PARSER_H */
@@ -18,52 +18,361 @@
  *  along with symlookup. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdio.h>
 #include <errno.h>
 #include <error.h>
 #include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <endian.h>
+#include <byteswap.h>
+#include <ar.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <gelf.h>
 #include <regex.h>
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
 
 #include "symlookup.h"
+#include "safemem.h"
 #include "scanelf.h"
+#include "skipcache.h"
+#include "mregex.h"
+#include "index.h"
 
-/* check if symbol <name> is wanted
-   1 == stop search in current file
-   0 == continue */
-static inline void check_symbol(const char* const symbolname, const char* const filename)
-{
-    /* iterate through user-provided symbols */
-    for (unsigned int i=0; i < symbol.size; i++)
-        if (!opt.re)    //usual comparison
-        {
-            if (!compare_func(symbol.str[i], symbolname)) {
-                do_match(i, filename, symbolname);
-                if (!opt.cas)
-                    break; //if ICASE, several matches are possible
-            }
-        } else {    //regexp
-            int res_code;
-            res_code = regexec(&symbol.regstr[i], symbolname, 0, NULL, 0);
-            switch (res_code) {
-                case REG_NOMATCH:
-                    break;
-                case 0:
-                    do_match(i, filename, symbolname);
-                    break;
-                default:
-                    if (opt.verb) {
-                        regerror(res_code, &symbol.regstr[symbol.size], reg_error_str, reg_error_str_len);
-                        error(0, errno, "warning: can't execute regular expression '%s': %s",
-                              symbol.str[i], reg_error_str);
-                    }
-                    break;
+/* byte order of ELF files which can be processed without conversion */
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+    #define ELFDATA_HOST ELFDATA2LSB
+#else
+    #define ELFDATA_HOST ELFDATA2MSB
+#endif
+
+/* symbol match strategies, each has its own scan kernel */
+enum {
+    MATCH_EXACT,        //exact symbols hash set
+    MATCH_FOLDED,       //case insensitive symbols hash set
+    MATCH_REGEX,        //regexps
+    MATCH_LITERAL,      //regexps, names with required literals only
+    MATCH_ALL           //all symbols are collected to index
+};
+
+/* matches collected by the calling thread, NULL stands for immediate report */
+static __thread struct found_t *found = NULL;
+
+/* collect matches of the calling thread in <list> instead of reporting them,
+   NULL restores immediate report */
+void collect_matches(struct found_t* const list)
+{
+    found = list;
+}
+
+/* report or collect matched symbol */
+static inline void report_match(const unsigned int i, const char* const filename,
+                                const char* const symbolname)
+{
+    size_t len;
+
+    if (!found) {
+        do_match(i, filename, symbolname);
+        return;
+    }
+
+    /* symbol names are stored in a single pool, because
+       file mapping will not survive till the report */
+    len = strlen(symbolname) + 1;
+    if (found->count == found->alloc) {
+        found->alloc = found->alloc ? found->alloc * 2 : 16;
+        found->idx = xrealloc(found->idx, sizeof(unsigned int) * found->alloc);
+        found->sym = xrealloc(found->sym, sizeof(size_t) * found->alloc);
+    }
+    if (found->used + len > found->size) {
+        found->size = (found->used + len) * 2;
+        found->pool = xrealloc(found->pool, found->size);
+    }
+    memcpy(found->pool + found->used, symbolname, len);
+    found->idx[found->count] = i;
+    found->sym[found->count] = found->used;
+    found->used += len;
+    found->count++;
+}
+
+/* find exact symbol <symbolname> in the hash set
+   index of user-provided symbol or -1 if it isn't requested */
+static inline int find_exact(const char* const symbolname)
+{
+    size_t len;
+    const uint32_t h = elf_gnu_hash_len(symbolname, &len);
+
+    for (unsigned int slot = h & symbol.set_mask; symbol.set[slot];
+         slot = (slot + 1) & symbol.set_mask) {
+        const unsigned int i = symbol.set[slot] - 1;
+        if (symbol.gnu_hash[i] == h && symbol.len[i] == len &&
+            !memcmp(symbol.str[i], symbolname, len))
+            return i;
+    }
+    return -1;
+}
+
+#ifdef __SSE2__
+/* fold ASCII uppercase letters of 16 bytes: 'A'..'Z' are moved to the
+   bottom of signed range, so a single comparison selects them */
+static inline __m128i fold16(const __m128i v)
+{
+    const __m128i t = _mm_sub_epi8(v, _mm_set1_epi8((char)('A' + 128)));
+    const __m128i upper = _mm_cmplt_epi8(t, _mm_set1_epi8(-128 + 26));
+    return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8('a' - 'A')));
+}
+#endif
+#ifdef __AVX2__
+static inline __m256i fold32(const __m256i v)
+{
+    const __m256i t = _mm256_sub_epi8(v, _mm256_set1_epi8((char)('A' + 128)));
+    const __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(-128 + 26), t);
+    return _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8('a' - 'A')));
+}
+#endif
+
+/* compare <len> bytes of <a> and <b> ignoring ASCII case
+   1 == equal
+   0 == different */
+static inline int fold_equal(const char* a, const char* b, size_t len)
+{
+#ifdef __AVX2__
+    for (; len >= 32; a += 32, b += 32, len -= 32) {
+        const __m256i x = fold32(_mm256_loadu_si256((const __m256i*)a));
+        const __m256i y = fold32(_mm256_loadu_si256((const __m256i*)b));
+        if ((unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) != 0xffffffffU)
+            return 0;
+    }
+#endif
+#ifdef __SSE2__
+    for (; len >= 16; a += 16, b += 16, len -= 16) {
+        const __m128i x = fold16(_mm_loadu_si128((const __m128i*)a));
+        const __m128i y = fold16(_mm_loadu_si128((const __m128i*)b));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) != 0xffff)
+            return 0;
+    }
+#endif
+    for (; len; a++, b++, len--)
+        if (fold_char(*a) != fold_char(*b))
+            return 0;
+    return 1;
+}
+
+/* find case insensitive symbol <symbolname> in the hash set, requested
+   symbols differing in case only share a folded key and are all
+   reported in ascending order; <filename> == NULL just checks for any
+   1 == found
+   0 == not requested */
+static inline int find_folded(const char* const symbolname, const char* const filename)
+{
+    size_t len;
+    const uint32_t h = fold_hash_len(symbolname, &len);
+    int found = 0;
+
+    for (unsigned int slot = h & symbol.set_mask; symbol.set[slot];
+         slot = (slot + 1) & symbol.set_mask) {
+        const unsigned int i = symbol.set[slot] - 1;
+        if (symbol.gnu_hash[i] == h && symbol.len[i] == len &&
+            fold_equal(symbol.str[i], symbolname, len)) {
+            if (!filename)
+                return 1;
+            report_match(i, filename, symbolname);
+            found = 1;
+        }
+    }
+    return found;
+}
+
+/* report exact symbol <symbolname> if it is requested;
+   exact symbols are unique, a single probe is enough */
+static inline void match_exact(const char* const symbolname, const char* const filename)
+{
+    const int i = find_exact(symbolname);
+    if (i >= 0)
+        report_match(i, filename, symbolname);
+}
+
+/* report all regexps matching <symbolname>, matched in one pass */
+static inline void match_regex(const char* const symbolname, const char* const filename)
+{
+    const uint64_t *const matched = mregex_exec(symbolname);
+    if (matched)
+        for (unsigned int i=0; i < symbol.size; i++)
+            if ((matched[i >> 6] >> (i & 63)) & 1)
+                report_match(i, filename, symbolname);
+}
+
+void check_symbol(const char* const symbolname, const char* const filename)
+{
+    if (opt.re)
+        match_regex(symbolname, filename);
+    else if (opt.cas)
+        find_folded(symbolname, filename);
+    else
+        match_exact(symbolname, filename);
+}
+
+/* match strategy of this run */
+static inline int match_strategy()
+{
+    if (opt.build_index)
+        return MATCH_ALL;
+    if (opt.re)
+        return (mregex_literals(NULL, NULL)) ? MATCH_LITERAL : MATCH_REGEX;
+    return (opt.cas) ? MATCH_FOLDED : MATCH_EXACT;
+}
+
+/* check whether ELF object of <e_type> is scanned, <type> is set
+   for pure elf and unset for archive members; the binary given with
+   --for-binary may be an executable
+   1 == scan it
+   0 == wrong type */
+static inline int type_wanted(const unsigned int e_type, const int type)
+{
+    if (type)
+        return e_type == ET_DYN || (e_type == ET_EXEC && opt.for_binary);
+    return e_type == ET_REL;
+}
+
+int symbol_wanted(const char* const symbolname)
+{
+    if (opt.re)
+        return mregex_exec(symbolname) != NULL;
+    if (opt.cas)
+        return find_folded(symbolname, NULL);
+    return find_exact(symbolname) >= 0;
+}
+
+/* Return pointer to <len> bytes at <ptr> suitable for structure access
+   with <align> requirement. Archive members are aligned to 2 bytes only,
+   so data is copied in such case and buffer to be freed is stored in <buf>. */
+static inline const void* aligned_view(const char* const ptr, const size_t len,
+                                       const size_t align, void** const buf)
+{
+    if (!((uintptr_t)ptr % align))
+        return ptr;
+    *buf = xmalloc(len);
+    memcpy(*buf, ptr, len);
+    return *buf;
+}
+
+/* literal found in a string table */
+struct hit_t {
+    size_t start;       //offset of the string containing literal
+    size_t pos;         //offset of literal
+};
+
+static int compare_hit(const void* const a, const void* const b)
+{
+    const struct hit_t *const x = a, *const y = b;
+    return (x->pos > y->pos) - (x->pos < y->pos);
+}
+
+/* Search string table <str> of <size> bytes in bulk for literals
+   required by user regexps. Found literals are stored to <*hits>
+   sorted by position, their number is returned. */
+static size_t strtab_hits(const char* const str, const size_t size, struct hit_t** const hits)
+{
+    const char *const *lit;
+    const size_t *lit_len;
+    const unsigned int nlit = mregex_literals(&lit, &lit_len);
+    size_t count = 0, alloc = 0;
+
+    *hits = NULL;
+    for (unsigned int k=0; k < nlit; k++)
+        for (const char *p = str, *end = str + size;
+             (p = memmem(p, end - p, lit[k], lit_len[k])); p++) {
+            const char *const nul = memrchr(str, '\0', p - str);
+            if (count == alloc) {
+                alloc = alloc ? alloc * 2 : 64;
+                *hits = xrealloc(*hits, sizeof(struct hit_t) * alloc);
             }
+            (*hits)[count].start = (nul) ? nul + 1 - str : 0;
+            (*hits)[count].pos = p - str;
+            count++;
         }
+    if (nlit > 1 && count > 1)
+        qsort(*hits, count, sizeof(struct hit_t), compare_hit);
+    return count;
+}
+
+/* check if name at offset <off> contains any of <count> <hits>:
+   the first literal after <off> must be within the same string */
+static inline int name_hit(const struct hit_t* const hits, const size_t count, const size_t off)
+{
+    size_t lo = 0, hi = count;
+
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if (hits[mid].pos < off)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < count && hits[lo].start <= off;
+}
+
+/* swap byte order of integer <x> of <size> bytes,
+   <size> is a constant at every use, so is the whole function */
+static inline uint64_t elf_swap(const uint64_t x, const size_t size)
+{
+    switch (size) {
+        case 2: return bswap_16(x);
+        case 4: return bswap_32(x);
+        case 8: return bswap_64(x);
+    }
+    return x;
+}
+
+/* native walkers for both ELF classes and byte orders */
+#define ELF_SWAP 0
+#define ELF_BITS 32
+#include "scanelf_tmpl.h"
+#undef ELF_BITS
+#define ELF_BITS 64
+#include "scanelf_tmpl.h"
+#undef ELF_BITS
+#undef ELF_SWAP
+#define ELF_SWAP 1
+#define ELF_BITS 32
+#include "scanelf_tmpl.h"
+#undef ELF_BITS
+#define ELF_BITS 64
+#include "scanelf_tmpl.h"
+#undef ELF_BITS
+#undef ELF_SWAP
+
+/* native walkers indexed by native_kind() */
+static int (*const native_readelf[])(const char* const, const size_t, const char* const,
+                                     const unsigned int) = {
+    native_readelf32, native_readelf_swap32, native_readelf64, native_readelf_swap64
+};
+static int (*const shdr_range[])(const char* const, const size_t, const unsigned int,
+                                 struct range_t* const) = {
+    shdr_range32, shdr_range_swap32, shdr_range64, shdr_range_swap64
+};
+static int (*const table_ranges[])(const char* const, const size_t, const unsigned int,
+                                   struct range_t* const, const unsigned int) = {
+    table_ranges32, table_ranges_swap32, table_ranges64, table_ranges_swap64
+};
+
+/* Select native walker for ELF <image> of <size> bytes by its class
+   and byte order, -1 if the file can't be processed natively. */
+static inline int native_kind(const char* const image, const size_t size)
+{
+    if (size < EI_NIDENT || image[EI_VERSION] != EV_CURRENT ||
+        (image[EI_DATA] != ELFDATA2LSB && image[EI_DATA] != ELFDATA2MSB) ||
+        (image[EI_CLASS] != ELFCLASS32 && image[EI_CLASS] != ELFCLASS64))
+        return -1;
+    return (image[EI_CLASS] == ELFCLASS64) * 2 + (image[EI_DATA] != ELFDATA_HOST);
 }
 
-/* parse object file, common for both elf and ar files */
+/* parse object file using libelf, common for both elf and ar files */
 /* type:
    ELF = 1;
    AR  = 0; */
@@ -79,18 +388,15 @@ static void readelf(Elf* const elf, const char* const filename, const unsigned i
     GElf_Sym sym;       //symbol from obj file
 
     /* type-dependant vars (elf | ar) */
-    Elf64_Half  e_type;
     Elf64_Word  sh_type;
     char *sh_type_str, *e_type_str;
 
     if (type) { //working with pure elf
-        e_type = ET_DYN;
         e_type_str = "DYN";
         sh_type = SHT_DYNSYM;
         sh_type_str = "DYNSYM";
     }
     else {      //working with elf objects from ar archive
-        e_type = ET_REL;
         e_type_str = "REL";
         sh_type = SHT_SYMTAB;
         sh_type_str = "SYMTAB";
@@ -98,7 +404,7 @@ static void readelf(Elf* const elf, const char* const filename, const unsigned i
 
     if (gelf_getehdr(elf, &ehdr))
     /* check header for DYN | REL obj type */
-    if (ehdr.e_type == e_type) {
+    if (type_wanted(ehdr.e_type, type)) {
         section = NULL;
         data = NULL;
 
@@ -120,15 +426,23 @@ static void readelf(Elf* const elf, const char* const filename, const unsigned i
                         if (gelf_getsym(data, i, &sym)) {
                             /* skip undefined symbols, read name of symbol */
                             if (sym.st_shndx != SHN_UNDEF) {
-                                if ((name = elf_strptr(elf, shdr.sh_link, sym.st_name)))
+                                if ((name = elf_strptr(elf, shdr.sh_link, sym.st_name))) {
                                     // got it!
-                                    check_symbol(name, filename);
+                                    if (opt.build_index)
+                                        index_symbol(name, sym.st_info);
+                                    else
+                                        check_symbol(name, filename);
+                                }
                                 else {      //can't convert symbol's name
                                     if (opt.verb)
                                         error(0, elf_errno(), "error: can't read name of symbol "
                                               "%i from %s setion in %s", i, sh_type_str, filename);
                                 }
                             } //symbol.sh_shndx
+                            /* undefined ones are indexed as references */
+                            else if (opt.build_index && sym.st_name &&
+                                     (name = elf_strptr(elf, shdr.sh_link, sym.st_name)))
+                                index_reference(name, sym.st_info);
                         } //gelf_getsym
                         else {  //can't get symbol
                             if (opt.verb)
@@ -155,26 +469,353 @@ static void readelf(Elf* const elf, const char* const filename, const unsigned i
     }
 }
 
-/* must take name of ordinary file to access from current directory,
- * full file name from the root of traversal (in order to show it for
- * user), and last name only, it is already returned by fts,
- * so I won't waste CPU time */
-void checkfile (const char* const filename,
-                const char* const fullfilename,
-                const char* const name)
+void not_wanted(const char* const fullfilename, const unsigned int so, const unsigned int ar)
+{
+    if (opt.verb >= V_VERBOSE)
+        error(0, 0, "%s is not an %s file", fullfilename,
+             (ar && so) ? "so neither an ar" : (so) ? "so" : "ar" );
+}
+
+/* process opened file <fd> via libelf stream */
+static void checkfile_libelf(const int fd, const char* const fullfilename,
+                             const struct stat* const st,
+                             const unsigned int so, const unsigned int ar)
+{
+    Elf *elf, *elf_ar;          //elf, Ar object pointer
+    Elf_Kind elf_type;          //elf type enum
+
+    // init elf object
+    if (!(elf = elf_begin(fd, ELF_C_READ, NULL)) && opt.verb)
+        error(0, elf_errno(), "error: elf_begin() failed for %s", fullfilename);
+    //ensure that file is ELF or AR
+    else {
+        elf_type = elf_kind(elf);
+        if (opt.build_index && ((elf_type == ELF_K_ELF && so) || (elf_type == ELF_K_AR && ar)))
+            index_file(fullfilename, st, elf_type == ELF_K_AR);
+        /* elf & requested */
+        if (elf_type == ELF_K_ELF && so)
+            readelf(elf, fullfilename, 1);
+        /* ar & requested */
+        else if (elf_type == ELF_K_AR && ar) {
+            /* iterate through ar archive, elf = ar header pointer */
+            Elf_Arhdr *arh;
+            Elf_Cmd cmd;
+
+            cmd = ELF_C_READ;
+            while ((elf_ar = elf_begin(fd, cmd, elf))) {
+                if (!(arh = elf_getarhdr(elf_ar)) )
+                {
+                    if (opt.verb)
+                        error(0, elf_errno(), "error: can't read ar header in %s", fullfilename);
+                    continue;
+                }
+                //omit archive symbol (/) and string (//) tables
+                if (strcmp(arh->ar_name, "/") && strcmp(arh->ar_name, "//")) {
+                    if (opt.build_index)
+                        index_member(arh->ar_name, strlen(arh->ar_name));
+                    readelf(elf_ar, fullfilename, 0);
+                }
+
+                //at the EOF cmd will be changed to ELF_C_NULL
+                cmd = elf_next(elf_ar);
+                elf_end(elf_ar);
+            }
+        }
+        else
+            not_wanted(fullfilename, so, ar);
+
+        // free mem & close
+        elf_end(elf);
+    }
+}
+
+/* Process ELF image, natively if possible and via libelf otherwise.
+   Image memory must be writable, since libelf may convert data in place.
+   Unread parts of <sparse> image are zeroed, so it is never passed to libelf.
+   Returns 0 if the image was processed and -1 if it must be read as a whole. */
+static int scanelf(char* const image, const size_t size, const char* const filename,
+                   const unsigned int type, const int sparse)
 {
-    static unsigned int so, ar;
-    static int fd;
-    static Elf *elf, *elf_ar;   //elf, Ar object pointer
-    static Elf_Kind elf_type;   //elf type enum
+    const int kind = native_kind(image, size);
+    Elf *elf;
+
+    if (kind >= 0 && !native_readelf[kind](image, size, filename, type))
+        return 0;
+    if (sparse)
+        return -1;
+
+    // odd file, fall back to libelf
+    if (!(elf = elf_memory(image, size))) {
+        if (opt.verb)
+            error(0, elf_errno(), "error: elf_memory() failed for %s", filename);
+        return 0;
+    }
+    readelf(elf, filename, type);
+    elf_end(elf);
+    return 0;
+}
+
+int elf_shdr_range(const char* const image, const size_t size, struct range_t* const range)
+{
+    // not an ELF file, scanimage() will tell
+    if (size < SELFMAG || memcmp(image, ELFMAG, SELFMAG))
+        return 0;
+    if (native_kind(image, size) < 0)
+        return -1;
+    return shdr_range[native_kind(image, size)](image, size, 1, range);
+}
 
+int elf_table_ranges(const char* const image, const size_t size,
+                     struct range_t* const range, const unsigned int max)
+{
+    return table_ranges[native_kind(image, size)](image, size, 1, range, max);
+}
+
+/* Read ar member header at <offset> of archive <image>.
+   Member data offset and size are stored in <data> and <msize>.
+   1 == ok
+   0 == broken header */
+static inline int read_arhdr(const char* const image, const size_t size, const size_t offset,
+                             const struct ar_hdr** const arh, size_t* const data,
+                             size_t* const msize)
+{
+    char *end;
+
+    *arh = (const struct ar_hdr*)(image + offset);
+    if (offset > size || size - offset < sizeof(struct ar_hdr) ||
+        memcmp((*arh)->ar_fmag, ARFMAG, sizeof((*arh)->ar_fmag)))
+        return 0;
+    *msize = strtoul((*arh)->ar_size, &end, 10);
+    if (end == (*arh)->ar_size || *msize > size - offset - sizeof(struct ar_hdr))
+        return 0;
+    *data = offset + sizeof(struct ar_hdr);
+    return 1;
+}
+
+/* process ar member data */
+static inline void scanmember(char* const image, const size_t msize, const char* const filename)
+{
+    if (msize >= SELFMAG && !memcmp(image, ELFMAG, SELFMAG))
+        scanelf(image, msize, filename, 0, 0);
+    else if (opt.verb)
+        error(0, 0, "warning: can't read ELF header in %s", filename);
+}
+
+/* comparison function for archive member offsets */
+static int compare_offset(const void* const a, const void* const b)
+{
+    const size_t x = *(const size_t*)a;
+    const size_t y = *(const size_t*)b;
+    return (x > y) - (x < y);
+}
+
+/* Find members defining wanted symbols via archive symbol table (armap)
+   <data> of <msize> bytes, <width> is 4 for "/" and 8 for "/SYM64/".
+   Offsets of member headers are stored sorted and unique in <offsets>,
+   their number is returned; -1 stands for broken armap. */
+static ssize_t armap_lookup(const unsigned char* const data, const size_t msize,
+                            const unsigned int width, size_t** const offsets)
+{
+    uint64_t count, off;
+    const unsigned char *ptr;
+    const char *name, *end;
+    size_t found = 0;
+
+    /* all numbers are big endian: count, offsets[count], names[count] */
+    if (msize < width)
+        return -1;
+    count = 0;
+    for (unsigned int j=0; j < width; j++)
+        count = count << 8 | data[j];
+    if (count > (msize - width) / width)
+        return -1;
+
+    *offsets = xmalloc(sizeof(size_t) * (count + 1));
+    name = (const char*)data + width * (count + 1);
+    end  = (const char*)data + msize;
+    ptr  = data + width;
+    for (uint64_t i=0; i < count; i++, ptr += width) {
+        if (name >= end || !memchr(name, '\0', end - name)) {
+            free(*offsets);
+            return -1;
+        }
+        if (symbol_wanted(name)) {
+            off = 0;
+            for (unsigned int j=0; j < width; j++)
+                off = off << 8 | ptr[j];
+            (*offsets)[found++] = off;
+        }
+        name += strlen(name) + 1;
+    }
+
+    /* several symbols are usually defined by the same member */
+    qsort(*offsets, found, sizeof(size_t), compare_offset);
+    count = found;
+    found = 0;
+    for (size_t i=0; i < count; i++)
+        if (!found || (*offsets)[i] != (*offsets)[found-1])
+            (*offsets)[found++] = (*offsets)[i];
+    return found;
+}
+
+/* Pass name of archive member <arh> to index; GNU archives keep names
+   longer than 15 characters in the "//" member <names> of <names_size>
+   bytes and refer to them as "/offset", other names end with '/' */
+static void index_arname(const struct ar_hdr* const arh, const char* const names,
+                         const size_t names_size)
+{
+    const char *name = arh->ar_name;
+    size_t len = sizeof(arh->ar_name);
+
+    if (name[0] == '/' && name[1] >= '0' && name[1] <= '9') {
+        size_t off = 0;
+        for (unsigned int j=1; j < sizeof(arh->ar_name) && name[j] >= '0' && name[j] <= '9'; j++)
+            off = off * 10 + name[j] - '0';
+        if (names && off < names_size) {
+            name = names + off;
+            for (len = 0; off + len < names_size && name[len] != '\n'; len++);
+        }
+    }
+    else
+        while (len && name[len-1] == ' ')
+            len--;
+    if (len > 1 && name[len-1] == '/')
+        len--;
+    index_member(name, len);
+}
+
+/* Iterate through ar archive image, members are processed as ELF images.
+   If archive has a symbol table (armap), only members defining wanted
+   symbols are opened; otherwise all members are walked. Index needs
+   all of them anyway. */
+static void scanar(char* const image, const size_t size, const char* const filename)
+{
+    const struct ar_hdr *arh;
+    size_t offset, data, msize;
+    size_t *offsets;
+    ssize_t count;
+    const char *names = NULL;   //long member names
+    size_t names_size = 0;
+
+    /* armap is always the first member */
+    count = -1;
+    if (!opt.build_index && read_arhdr(image, size, SARMAG, &arh, &data, &msize)) {
+        if (!memcmp(arh->ar_name, "/ ", 2))
+            count = armap_lookup((unsigned char*)image + data, msize, 4, &offsets);
+        else if (!memcmp(arh->ar_name, "/SYM64/ ", 8))
+            count = armap_lookup((unsigned char*)image + data, msize, 8, &offsets);
+    }
+
+    if (count >= 0) {
+        for (ssize_t i=0; i < count; i++) {
+            if (!read_arhdr(image, size, offsets[i], &arh, &data, &msize)) {
+                if (opt.verb)
+                    error(0, 0, "error: can't read ar header in %s", filename);
+                break;
+            }
+            scanmember(image + data, msize, filename);
+        }
+        free(offsets);
+        return;
+    }
+
+    /* no usable armap, walk all members */
+    for (offset = SARMAG; offset < size; offset = data + msize + (msize & 1)) {
+        if (!read_arhdr(image, size, offset, &arh, &data, &msize)) {
+            if (opt.verb)
+                error(0, 0, "error: can't read ar header in %s", filename);
+            return;
+        }
+
+        //omit archive symbol (/, /SYM64/) and string (//) tables
+        if (arh->ar_name[0] == '/' && (arh->ar_name[1] == ' ' ||
+            arh->ar_name[1] == '/' || !memcmp(arh->ar_name, "/SYM64/", 7))) {
+            if (arh->ar_name[1] == '/') {
+                names = image + data;
+                names_size = msize;
+            }
+            continue;
+        }
+
+        if (opt.build_index)
+            index_arname(arh, names, names_size);
+        scanmember(image + data, msize, filename);
+    }
+}
+
+/* dispatch mapped file image by its magic */
+int scanimage(char* const image, const size_t size, const char* const fullfilename,
+              const struct stat* const st, const unsigned int so, const unsigned int ar,
+              const int sparse)
+{
+    /* elf & requested */
+    if (so && size >= SELFMAG && !memcmp(image, ELFMAG, SELFMAG)) {
+        if (opt.build_index)
+            index_file(fullfilename, st, 0);
+        if (scanelf(image, size, fullfilename, 1, sparse) < 0) {
+            // nothing was recorded, the file is indexed when read again
+            if (opt.build_index)
+                index_file_drop();
+            return -1;
+        }
+    }
+    /* ar & requested */
+    else if (ar && size >= SARMAG && !memcmp(image, ARMAG, SARMAG)) {
+        if (opt.build_index)
+            index_file(fullfilename, st, 1);
+        scanar(image, size, fullfilename);
+    }
+    else
+        not_wanted(fullfilename, so, ar);
+    return 0;
+}
+
+/* prefetch range <r> of file mapping <image> */
+static inline void prefetch(char* const image, const struct range_t* const r)
+{
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t skew = r->off & (page - 1);
+
+    madvise(image + r->off - skew, r->len + skew, MADV_WILLNEED);
+}
+
+/* Native scan of a shared object touches only the elf header, section
+   header table and symbol, string and hash tables; read-ahead around
+   each page fault would pull in the code and data of big libraries too.
+   So disable it for the mapping and prefetch exactly the tables instead. */
+static void advise_image(char* const image, const size_t size)
+{
+    struct range_t range[16];
+    int count;
+
+    // even the magic check must not fault in read-ahead
+    madvise(image, size, MADV_RANDOM);
+    if (size < SELFMAG || memcmp(image, ELFMAG, SELFMAG)) {
+        madvise(image, size, MADV_NORMAL);
+        return;
+    }
+
+    if (elf_shdr_range(image, size, &range[0]) != 1)
+        return;
+    prefetch(image, &range[0]);
+    if ((count = elf_table_ranges(image, size, range, 16)) < 0)
+        return;
+    for (int i=0; i < count; i++)
+        prefetch(image, &range[i]);
+}
+
+/* select file type by its last name <name>
+   1 == file must be scanned, <so> and <ar> tell how
+   0 == skip it */
+int file_wanted(const char* const name, unsigned int* const so, unsigned int* const ar)
+{
     /* name regular expression check */
     if (opt.file_re) {
         int res_code;
         res_code = regexec(opt.file_re, name, 0, NULL, 0);
         switch (res_code) {
             case REG_NOMATCH:
-                return;
+                return 0;
                 break;
             case 0:
                 break;
@@ -192,20 +833,40 @@ void checkfile (const char* const filename,
         // select so by: ".*\.so\..*" || so = ".*\.so$"
         if ( opt.so && (strstr(name, ".so.") ||
              !strcmp(name + strlen(name)-3 ,".so")) ) {
-            so = 1;
-            ar = 0;
+            *so = 1;
+            *ar = 0;
         }
         else if (opt.ar && !strcmp(name + strlen(name)-2 ,".a")) {
-            so = 0;
-            ar = 1;
+            *so = 0;
+            *ar = 1;
         }
         else
-            return;
+            return 0;
     }   //skip extension test, only honour CLI options
     else {
-        so = opt.so;
-        ar = opt.ar;
+        *so = opt.so;
+        *ar = opt.ar;
     }
+    return 1;
+}
+
+/* must take name of ordinary file to access from current directory,
+ * full file name from the root of traversal (in order to show it for
+ * user), and last name only, it is already returned by fts,
+ * so I won't waste CPU time */
+void checkfile (const char* const filename,
+                const char* const fullfilename,
+                const char* const name)
+{
+    unsigned int so, ar;
+    int fd;
+    struct stat st;
+    const struct stat *stp = &st; //NULL if status is unknown
+    char *image;                //mapped file
+    int skip = 0;               //file of unwanted type
+
+    if (!file_wanted(name, &so, &ar))
+        return;
 
     /* preliminary reading of ELF-file */
     if ((fd = open(filename, O_RDONLY)) == -1) {
@@ -213,47 +874,132 @@ void checkfile (const char* const filename,
             error(0, errno, "warning: can't open file %s for reading", fullfilename);
         return;
     }
-    // init elf object
-    if (!(elf = elf_begin(fd, ELF_C_READ, NULL)) && opt.verb)
-        error(0, elf_errno(), "error: elf_begin() failed for %s", fullfilename);
-    //ensure that file is ELF or AR
-    else {
-        elf_type = elf_kind(elf);
-        /* elf & requested */
-        if (elf_type == ELF_K_ELF && so)
-            readelf(elf, fullfilename, 1);
-        /* ar & requested */
-        else if (elf_type == ELF_K_AR && ar) {
-            /* iterate through ar archive, elf = ar header pointer */
-            Elf_Arhdr *arh;
-            Elf_Cmd cmd;
 
-            cmd = ELF_C_READ;
-            while ((elf_ar = elf_begin(fd, cmd, elf))) {
-                if (!(arh = elf_getarhdr(elf_ar)) )
-                {
-                    if (opt.verb)
-                        error(0, elf_errno(), "error: can't read ar header in %s", fullfilename);
-                    continue;
-                }
-                //omit archive symbol (/) and string (//) tables
-                if (strcmp(arh->ar_name, "/") && strcmp(arh->ar_name, "//"))
-                    readelf(elf_ar, fullfilename, 0);
+    /* map file for native processing, use libelf stream on failure */
+    image = MAP_FAILED;
+    if (fstat(fd, &st))
+        stp = NULL;
+    else if (st.st_size > 0) {
+        /* magic prefilter: don't map files of unwanted type at all */
+        char magic[SARMAG];
+        const ssize_t len = pread(fd, magic, SARMAG, 0);
+        const int is_elf = len >= SELFMAG && !memcmp(magic, ELFMAG, SELFMAG);
+        const int is_ar  = len >= SARMAG && !memcmp(magic, ARMAG, SARMAG);
 
-                //at the EOF cmd will be changed to ELF_C_NULL
-                cmd = elf_next(elf_ar);
-                elf_end(elf_ar);
-            }
+        if (len >= 0 && !(so && is_elf) && !(ar && is_ar)) {
+            if (!is_elf && !is_ar)
+                skipcache_add(&st);
+            not_wanted(fullfilename, so, ar);
+            skip = 1;
         }
-        else if (opt.verb >= V_VERBOSE)
-            error(0, 0, "%s is not an %s file", fullfilename,
-                 (ar && so) ? "so neither an ar" : (so) ? "so" : "ar" );
+        else
+            image = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
 
-        // free mem & close
-        elf_end(elf);
+    if (image != MAP_FAILED) {
+        if (so)
+            advise_image(image, st.st_size);
+        scanimage(image, st.st_size, fullfilename, stp, so, ar, 0);
+        munmap(image, st.st_size);
     }
+    else if (!skip)
+        checkfile_libelf(fd, fullfilename, stp, so, ar);
+
     if (close(fd) == -1 && opt.verb)
         error(0, errno, "error: can't close file %s; "
                         "subsequent processing may be unreliable", fullfilename);
 }
 
+
+/* comparison function for symbol names */
+static int compare_name(const void* const a, const void* const b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/* Add global symbols of <elf> to <undef> or <def>: dynamic ones
+   of executables and shared objects, symbol table of relocatables. */
+static void collect_symbols(Elf* const elf, const char* const filename,
+                            struct str_t* const undef, struct str_t* const def)
+{
+    GElf_Ehdr ehdr;
+    Elf_Scn *section = NULL;
+    GElf_Shdr shdr;
+
+    if (!gelf_getehdr(elf, &ehdr)) {
+        if (opt.verb)
+            error(0, elf_errno(), "warning: can't read ELF header in %s", filename);
+        return;
+    }
+    const Elf64_Word sh_type = (ehdr.e_type == ET_REL) ? SHT_SYMTAB : SHT_DYNSYM;
+
+    while ((section = elf_nextscn(elf, section)))
+        if (gelf_getshdr(section, &shdr) == &shdr && shdr.sh_type == sh_type &&
+            shdr.sh_entsize) {
+            const size_t count = shdr.sh_size / shdr.sh_entsize;
+            Elf_Data *const data = elf_getdata(section, NULL);
+            GElf_Sym sym;
+            const char *name;
+
+            // sh_info -- index of 1st non-local symbol
+            for (size_t i=shdr.sh_info; data && i < count; i++)
+                if (gelf_getsym(data, i, &sym) && sym.st_name &&
+                    (name = elf_strptr(elf, shdr.sh_link, sym.st_name)) && *name)
+                    grow_str((sym.st_shndx == SHN_UNDEF) ? undef : def, name);
+        }
+}
+
+void undefined_of(const char* const filename, void (*const add)(const char* const))
+{
+    struct str_t undef = {0, NULL},
+                 def   = {0, NULL};
+    Elf *elf, *elf_ar;
+    unsigned int count = 0;
+    int fd;
+
+    /* libelf is used before main() initializes it */
+    if (elf_version(EV_CURRENT) == EV_NONE)
+        error(ERR_ELF, elf_errno(), "fatal: cannot initialize libelf");
+    if ((fd = open(filename, O_RDONLY)) == -1)
+        error(ERR_IO, errno, "i/o error: can't read %s", filename);
+    if (!(elf = elf_begin(fd, ELF_C_READ, NULL)))
+        error(ERR_ELF, elf_errno(), "error: elf_begin() failed for %s", filename);
+
+    if (elf_kind(elf) == ELF_K_ELF)
+        collect_symbols(elf, filename, &undef, &def);
+    else if (elf_kind(elf) == ELF_K_AR) {
+        Elf_Cmd cmd = ELF_C_READ;
+        Elf_Arhdr *arh;
+
+        while ((elf_ar = elf_begin(fd, cmd, elf))) {
+            //omit archive symbol (/) and string (//) tables
+            if ((arh = elf_getarhdr(elf_ar)) && strcmp(arh->ar_name, "/") &&
+                strcmp(arh->ar_name, "//") && elf_kind(elf_ar) == ELF_K_ELF)
+                collect_symbols(elf_ar, filename, &undef, &def);
+            cmd = elf_next(elf_ar);
+            elf_end(elf_ar);
+        }
+    }
+    else
+        error(ERR_ELF, 0, "%s is neither ELF nor ar file", filename);
+    elf_end(elf);
+    close(fd);
+
+    /* members may share references, symbols defined by other members
+       are resolved already */
+    if (undef.size > 1)
+        qsort(undef.str, undef.size, sizeof(char*), compare_name);
+    if (def.size > 1)
+        qsort(def.str, def.size, sizeof(char*), compare_name);
+    for (unsigned int i=0; i < undef.size; i++)
+        if ((!i || strcmp(undef.str[i], undef.str[i-1])) && (!def.size ||
+            !bsearch(&undef.str[i], def.str, def.size, sizeof(char*), compare_name))) {
+            add(undef.str[i]);
+            count++;
+        }
+
+    if (opt.verb >= V_VERBOSE)
+        printf("--> %u undefined symbols are read from %s\n", count, filename);
+    free_str(&undef);
+    free_str(&def);
+}
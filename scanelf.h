@@ -21,6 +21,81 @@
 #ifndef SL_SCANELF_H
 #define SL_SCANELF_H
 
+#include <stdint.h>
+#include <stddef.h>
+
+/* SysV ELF hash function, as used by DT_HASH tables */
+static inline uint32_t elf_sysv_hash(const char* name)
+{
+    uint32_t h = 0, g;
+    for (; *name; name++) {
+        h = (h << 4) + (unsigned char)*name;
+        if ((g = h & 0xf0000000))
+            h ^= g >> 24;
+        h &= ~g;
+    }
+    return h;
+}
+
+/* GNU ELF hash (Bernstein's one, as used by DT_GNU_HASH tables) of <name>,
+   its length is stored to <len> */
+static inline uint32_t elf_gnu_hash_len(const char* const name, size_t* const len)
+{
+    uint32_t h = 5381;
+    const char *p = name;
+    for (; *p; p++)
+        h = (h << 5) + h + (unsigned char)*p;
+    *len = p - name;
+    return h;
+}
+
+/* ASCII lowercase of <c>, the only folding done in the C locale */
+static inline unsigned char fold_char(const unsigned char c)
+{
+    return c + ((unsigned char)(c - 'A') < 26) * ('a' - 'A');
+}
+
+/* GNU ELF hash of case folded <name>, its length is stored to <len> */
+static inline uint32_t fold_hash_len(const char* const name, size_t* const len)
+{
+    uint32_t h = 5381;
+    const char *p = name;
+    for (; *p; p++)
+        h = (h << 5) + h + fold_char(*p);
+    *len = p - name;
+    return h;
+}
+
+/* matches found by a scan worker in a single file */
+struct found_t {
+    unsigned int count;         //number of matches
+    unsigned int alloc;         //number of allocated matches
+    unsigned int *idx;          //indexes of user-provided symbols
+    size_t *sym;                //offsets of matched symbol names in the pool
+    char *pool;                 //matched symbol names
+    size_t used;                //pool bytes used
+    size_t size;                //pool bytes allocated
+};
+
+/* range of file */
+struct range_t {
+    size_t off;
+    size_t len;
+};
+
+/* collect matches of the calling thread in <list> instead of reporting them,
+   NULL restores immediate report */
+void collect_matches(struct found_t* const list);
+
+/* check if symbol <symbolname> matches any user-provided symbol,
+   nothing is reported; used to preselect archive members and index entries
+   1 == wanted
+   0 == not wanted */
+int symbol_wanted(const char* const symbolname);
+
+/* report all user-provided symbols matching <symbolname> found in <filename> */
+void check_symbol(const char* const symbolname, const char* const filename);
+
 /* must take name of ordinary file to access from current directory,
  * full file name from the root of traversal (in order to show it for
  * user), and last name only, it is already returned by fts,
@@ -29,4 +104,41 @@ void checkfile (const char* const filename,
                 const char* const fullfilename,
                 const char* const name);
 
+/* select file type by its last name <name>
+   1 == file must be scanned, <so> and <ar> tell how
+   0 == skip it */
+int file_wanted(const char* const name, unsigned int* const so, unsigned int* const ar);
+
+/* report file of type unwanted by <so> and <ar> */
+void not_wanted(const char* const fullfilename, const unsigned int so, const unsigned int ar);
+
+/* dispatch file <image> of <size> bytes by its magic, <so> and <ar>
+ * are given by file_wanted(), <st> is file status for index (may be NULL);
+ * the image must be writable, but only ranges located by the functions
+ * below are read for shared objects. If only these ranges are in place
+ * (<sparse> != 0) and they are not enough, -1 is returned and the file
+ * must be scanned from a full mapping; 0 is returned otherwise */
+struct stat;
+int scanimage(char* const image, const size_t size, const char* const fullfilename,
+              const struct stat* const st, const unsigned int so, const unsigned int ar,
+              const int sparse);
+
+/* Locate section header table of shared object file of <size> bytes,
+   <image> must hold the elf header.
+   Returns 1 if the table is stored to <range>, 0 if there is nothing
+   more to read and -1 if the file must be read as a whole. */
+int elf_shdr_range(const char* const image, const size_t size, struct range_t* const range);
+
+/* Locate symbol, string and hash tables of shared object file of <size> bytes,
+   <image> must hold the elf header and section header table.
+   Returns number of ranges stored to <range> (<max> at most)
+   or -1 if the file must be read as a whole. */
+int elf_table_ranges(const char* const image, const size_t size,
+                     struct range_t* const range, const unsigned int max);
+
+/* Read undefined global symbols of ELF object, executable or ar archive
+   <filename> and pass each to <add>; symbols defined by another member
+   of the archive are skipped. Errors are fatal. */
+void undefined_of(const char* const filename, void (*const add)(const char* const));
+
 #endif /* SL_SCANELF_H */
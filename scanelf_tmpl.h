@@ -0,0 +1,491 @@
+/*
+ *  Native ELF symbol table walker template
+ *  Copyright © 2007-2011 Andrew Savchenko
+ *
+ *  This file is part of symlookup.
+ *
+ *  symlookup is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 3 as
+ *  published by the Free Software Foundation
+ *
+ *  symlookup is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License version 3 for more details.
+ *
+ *  You should have received a copy of the GNU General Public License version 3
+ *  along with symlookup. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file is not a standalone header: it is included by scanelf.c
+ * once per ELF class and byte order with ELF_BITS defined to 32 or 64
+ * and ELF_SWAP to 1 for foreign byte order, so the same code walks
+ * Elf32 and Elf64 structures of both byte orders in place. Headers of
+ * foreign files are converted once, symbol and hash tables are read
+ * through ElfR(). */
+
+#if !defined(ELF_BITS) || !defined(ELF_SWAP)
+#error "ELF_BITS and ELF_SWAP must be defined before scanelf_tmpl.h inclusion"
+#endif
+
+#define ElfW(type)          ElfW_(ELF_BITS, type)
+#define ElfW_(bits, type)   ElfW__(bits, type)
+#define ElfW__(bits, type)  Elf##bits##_##type
+#if ELF_SWAP
+#define ElfN(name)          ElfN_(name##_swap, ELF_BITS)
+#define ElfR(x)             ((__typeof__(x))elf_swap(x, sizeof(x)))
+#else
+#define ElfN(name)          ElfN_(name, ELF_BITS)
+#define ElfR(x)             (x)
+#endif
+#define ElfN_(name, bits)   ElfN__(name, bits)
+#define ElfN__(name, bits)  name##bits
+
+/* check that section <shdr> lies within the image */
+static inline int ElfN(section_fits)(const ElfW(Shdr)* const shdr, const size_t size)
+{
+    return shdr->sh_offset <= size && shdr->sh_size <= size - shdr->sh_offset;
+}
+
+/* copy ELF header of <image> to <ehdr> in host byte order */
+static inline void ElfN(read_ehdr)(const char* const image, ElfW(Ehdr)* const ehdr)
+{
+    memcpy(ehdr, image, sizeof(*ehdr));
+#if ELF_SWAP
+    ehdr->e_type      = ElfR(ehdr->e_type);
+    ehdr->e_shoff     = ElfR(ehdr->e_shoff);
+    ehdr->e_shentsize = ElfR(ehdr->e_shentsize);
+    ehdr->e_shnum     = ElfR(ehdr->e_shnum);
+#endif
+}
+
+/* Get section header table described by <ehdr> in host byte order,
+   buffer to be freed is stored in <buf> if data is copied. */
+static inline const ElfW(Shdr)* ElfN(read_shdr)(const char* const image,
+                                                const ElfW(Ehdr)* const ehdr, void** const buf)
+{
+#if ELF_SWAP
+    ElfW(Shdr) *const shdr = xmalloc(ehdr->e_shnum * sizeof(ElfW(Shdr)));
+
+    memcpy(shdr, image + ehdr->e_shoff, ehdr->e_shnum * sizeof(ElfW(Shdr)));
+    for (unsigned int i=0; i < ehdr->e_shnum; i++) {
+        shdr[i].sh_type    = ElfR(shdr[i].sh_type);
+        shdr[i].sh_offset  = ElfR(shdr[i].sh_offset);
+        shdr[i].sh_size    = ElfR(shdr[i].sh_size);
+        shdr[i].sh_link    = ElfR(shdr[i].sh_link);
+        shdr[i].sh_info    = ElfR(shdr[i].sh_info);
+        shdr[i].sh_entsize = ElfR(shdr[i].sh_entsize);
+    }
+    *buf = shdr;
+    return shdr;
+#else
+    return aligned_view(image + ehdr->e_shoff, ehdr->e_shnum * sizeof(ElfW(Shdr)),
+                        __alignof__(ElfW(Shdr)), buf);
+#endif
+}
+
+/* Check that symbol table <sym> and its string table are sane,
+   so they can be walked without any further checks.
+   1 == ok
+   0 == leave this file to libelf */
+static inline int ElfN(symtab_valid)(const char* const image, const size_t size,
+                                     const ElfW(Shdr)* const shdr, const unsigned int shnum,
+                                     const ElfW(Shdr)* const sym)
+{
+    const ElfW(Shdr) *str;
+
+    if (sym->sh_entsize != sizeof(ElfW(Sym)) || !ElfN(section_fits)(sym, size) ||
+        sym->sh_link >= shnum)
+        return 0;
+
+    str = &shdr[sym->sh_link];
+    if (str->sh_type != SHT_STRTAB || !str->sh_size || !ElfN(section_fits)(str, size))
+        return 0;
+
+    // NUL at the end of the string table guarantees all names are terminated
+    return !image[str->sh_offset + str->sh_size - 1];
+}
+
+/* symbol table being walked */
+struct ElfN(symtab_t) {
+    const ElfW(Sym) *sym;       //symbols
+    ElfW(Word) count;           //number of symbols
+    ElfW(Word) info;            //index of 1st non-local symbol
+    const char *str;            //string table
+    ElfW(Word) strsz;           //string table size
+};
+
+/* report symbol <j> from <tab> if it is defined and named as requested symbol <k> */
+static inline void ElfN(probe_symbol)(const struct ElfN(symtab_t)* const tab, const ElfW(Word) j,
+                                      const unsigned int k, const char* const filename)
+{
+    if (j < tab->info || j >= tab->count || ElfR(tab->sym[j].st_shndx) == SHN_UNDEF ||
+        ElfR(tab->sym[j].st_name) >= tab->strsz)
+        return;
+    if (!strcmp(tab->str + ElfR(tab->sym[j].st_name), symbol.str[k]))
+        report_match(k, filename, symbol.str[k]);
+}
+
+/* Check GNU hash section <hash> for dynamic symbol table <tab>
+   and return pointer to its data, NULL if it is unusable */
+static inline const Elf32_Word* ElfN(gnu_hash_valid)(const char* const image, const size_t size,
+                                                     const ElfW(Shdr)* const hash,
+                                                     const struct ElfN(symtab_t)* const tab)
+{
+    const Elf32_Word *h;
+    Elf32_Word nbuckets, symoffset, bloom_size, shift;
+
+    if (!ElfN(section_fits)(hash, size) || hash->sh_size < 4 * sizeof(Elf32_Word) ||
+        (uintptr_t)(image + hash->sh_offset) % __alignof__(ElfW(Addr)))
+        return NULL;
+    h = (const Elf32_Word*)(image + hash->sh_offset);
+    nbuckets = ElfR(h[0]);
+    symoffset = ElfR(h[1]);
+    bloom_size = ElfR(h[2]);
+    shift = ElfR(h[3]);
+
+    // bloom filter size must be a power of 2
+    if (!nbuckets || symoffset > tab->count || !bloom_size || (bloom_size & (bloom_size - 1)) ||
+        shift >= ELF_BITS ||
+        4 * sizeof(Elf32_Word) + (uint64_t)bloom_size * sizeof(ElfW(Addr)) +
+        ((uint64_t)nbuckets + tab->count - symoffset) * sizeof(Elf32_Word) > hash->sh_size)
+        return NULL;
+    return h;
+}
+
+/* Check SysV hash section <hash> for dynamic symbol table <tab>
+   and return pointer to its data, NULL if it is unusable */
+static inline const Elf32_Word* ElfN(sysv_hash_valid)(const char* const image, const size_t size,
+                                                      const ElfW(Shdr)* const hash,
+                                                      const struct ElfN(symtab_t)* const tab)
+{
+    const Elf32_Word *h;
+
+    // some 64-bit platforms use 8-byte hash entries, these are not supported
+    if (hash->sh_entsize != sizeof(Elf32_Word) || !ElfN(section_fits)(hash, size) ||
+        hash->sh_size < 2 * sizeof(Elf32_Word) ||
+        (uintptr_t)(image + hash->sh_offset) % __alignof__(Elf32_Word))
+        return NULL;
+    h = (const Elf32_Word*)(image + hash->sh_offset);
+
+    // nbucket, nchain
+    if (!ElfR(h[0]) || ElfR(h[1]) != tab->count ||
+        (2 + (uint64_t)ElfR(h[0]) + ElfR(h[1])) * sizeof(Elf32_Word) > hash->sh_size)
+        return NULL;
+    return h;
+}
+
+/* look up all requested symbols via GNU hash table <h> */
+static void ElfN(gnu_lookup)(const struct ElfN(symtab_t)* const tab, const Elf32_Word* const h,
+                             const char* const filename)
+{
+    const Elf32_Word nbuckets = ElfR(h[0]), symoffset = ElfR(h[1]),
+                     bloom_mask = ElfR(h[2]) - 1, shift = ElfR(h[3]);
+    const ElfW(Addr) *const bloom = (const ElfW(Addr)*)(h + 4);
+    const Elf32_Word *const buckets = (const Elf32_Word*)(bloom + bloom_mask + 1);
+    const Elf32_Word *const chain = buckets + nbuckets;
+    ElfW(Addr) word, mask;
+    Elf32_Word hash, j;
+
+    for (unsigned int k=0; k < symbol.size; k++) {
+        hash = symbol.gnu_hash[k];
+
+        /* bloom filter rejects most of absent symbols at once */
+        word = ElfR(bloom[(hash / ELF_BITS) & bloom_mask]);
+        mask = (ElfW(Addr))1 << (hash % ELF_BITS) |
+               (ElfW(Addr))1 << ((hash >> shift) % ELF_BITS);
+        if ((word & mask) != mask)
+            continue;
+
+        if ((j = ElfR(buckets[hash % nbuckets])) < symoffset)
+            continue;
+        /* walk the chain, the lowest bit marks its end;
+           several versions of the same symbol may be present */
+        for (; j < tab->count; j++) {
+            const Elf32_Word link = ElfR(chain[j - symoffset]);
+            if ((link | 1) == (hash | 1))
+                ElfN(probe_symbol)(tab, j, k, filename);
+            if (link & 1)
+                break;
+        }
+    }
+}
+
+/* look up all requested symbols via SysV hash table <h> */
+static void ElfN(sysv_lookup)(const struct ElfN(symtab_t)* const tab, const Elf32_Word* const h,
+                              const char* const filename)
+{
+    const Elf32_Word nbucket = ElfR(h[0]), nchain = ElfR(h[1]);
+    const Elf32_Word *const bucket = h + 2;
+    const Elf32_Word *const chain = bucket + nbucket;
+    Elf32_Word j, steps;
+
+    for (unsigned int k=0; k < symbol.size; k++)
+        // steps limit protects from looped chains in broken files
+        for (j = ElfR(bucket[symbol.hash[k] % nbucket]), steps = 0;
+             j != STN_UNDEF && j < nchain && steps < nchain;
+             j = ElfR(chain[j]), steps++)
+            ElfN(probe_symbol)(tab, j, k, filename);
+}
+
+/* Match names of defined non-local symbols of <tab> using <strategy>,
+   MATCH_ALL collects undefined ones too. <strategy> is a constant in
+   every kernel below, so the compiler drops all the other branches and
+   the loop has no mode checks left. <hits> are used by MATCH_LITERAL only. */
+static inline __attribute__((always_inline))
+void ElfN(walk)(const struct ElfN(symtab_t)* const tab, const char* const filename,
+                const char* const sh_type_str, const struct hit_t* const hits,
+                const size_t hit_count, const int strategy)
+{
+    // sh_info -- index of 1st non-local symbol
+    for (ElfW(Word) j = tab->info; j < tab->count; j++) {
+        const ElfW(Word) name = ElfR(tab->sym[j].st_name);
+
+        /* skip undefined symbols, unless references are indexed */
+        if (ElfR(tab->sym[j].st_shndx) == SHN_UNDEF) {
+            if (strategy == MATCH_ALL && name && name < tab->strsz)
+                index_reference(tab->str + name, tab->sym[j].st_info);
+            continue;
+        }
+        if (name >= tab->strsz) {
+            if (opt.verb)
+                error(0, 0, "error: can't read name of symbol %u from %s setion in %s",
+                      j, sh_type_str, filename);
+            continue;
+        }
+        // got it!
+        switch (strategy) {
+            case MATCH_EXACT:
+                match_exact(tab->str + name, filename);
+                break;
+            case MATCH_FOLDED:
+                find_folded(tab->str + name, filename);
+                break;
+            case MATCH_LITERAL:
+                if (!name_hit(hits, hit_count, name))
+                    break;
+                // fall through
+            case MATCH_REGEX:
+                match_regex(tab->str + name, filename);
+                break;
+            case MATCH_ALL:
+                index_symbol(tab->str + name, tab->sym[j].st_info);
+                break;
+        }
+    }
+}
+
+#define ElfN_walk_kernel(strategy, kernel)                                      \
+static void ElfN(kernel)(const struct ElfN(symtab_t)* const tab,                \
+                         const char* const filename, const char* const sh_type_str, \
+                         const struct hit_t* const hits, const size_t hit_count) \
+{                                                                               \
+    ElfN(walk)(tab, filename, sh_type_str, hits, hit_count, strategy);         \
+}
+ElfN_walk_kernel(MATCH_EXACT, walk_exact)
+ElfN_walk_kernel(MATCH_FOLDED, walk_folded)
+ElfN_walk_kernel(MATCH_REGEX, walk_regex)
+ElfN_walk_kernel(MATCH_LITERAL, walk_literal)
+ElfN_walk_kernel(MATCH_ALL, walk_all)
+#undef ElfN_walk_kernel
+
+/* symbol walk kernels indexed by match strategy */
+static void (*const ElfN(walkers)[])(const struct ElfN(symtab_t)* const, const char* const,
+                                     const char* const, const struct hit_t* const,
+                                     const size_t) = {
+    [MATCH_EXACT]   = ElfN(walk_exact),
+    [MATCH_FOLDED]  = ElfN(walk_folded),
+    [MATCH_REGEX]   = ElfN(walk_regex),
+    [MATCH_LITERAL] = ElfN(walk_literal),
+    [MATCH_ALL]     = ElfN(walk_all)
+};
+
+/* Parse object file image in place, common for both elf and ar files.
+   type:
+   ELF = 1;
+   AR  = 0;
+   Returns 0 if file was processed and -1 if it must be passed to libelf;
+   the latter is decided before any symbol is reported. */
+static int ElfN(native_readelf)(const char* const image, const size_t size,
+                                const char* const filename, const unsigned int type)
+{
+    ElfW(Ehdr) ehdr;                //elf header, archive members may be unaligned
+    const ElfW(Shdr) *shdr;         //section header table
+    struct ElfN(symtab_t) tab;      //symbol table
+    const Elf32_Word *hash;         //hash table
+    void *shdr_buf = NULL, *sym_buf;
+    struct hit_t *hits = NULL;      //literals found in string table
+    size_t hit_count = 0;
+    const int strategy = match_strategy();
+
+    const ElfW(Word) sh_type = (type) ? SHT_DYNSYM : SHT_SYMTAB;
+    const char *const sh_type_str = (type) ? "DYNSYM" : "SYMTAB";
+
+    if (size < sizeof(ehdr))
+        return -1;
+    ElfN(read_ehdr)(image, &ehdr);
+
+    /* check header for DYN | REL obj type */
+    if (!type_wanted(ehdr.e_type, type)) {
+        if (opt.verb)
+            error(0, 0, "%s ELF type is not %s, it is 0x%x", filename,
+                  (type) ? "DYN" : "REL", ehdr.e_type);
+        return 0;
+    }
+
+    // no section header table: nothing to look for
+    if (!ehdr.e_shoff && !ehdr.e_shnum)
+        return 0;
+    // extended section numbering and foreign layouts are left to libelf
+    if (!ehdr.e_shnum || ehdr.e_shentsize != sizeof(ElfW(Shdr)) ||
+        ehdr.e_shoff > size || (size - ehdr.e_shoff) / sizeof(ElfW(Shdr)) < ehdr.e_shnum)
+        return -1;
+
+    shdr = ElfN(read_shdr)(image, &ehdr, &shdr_buf);
+
+    /* validate all symbol tables before the first match is reported */
+    for (unsigned int i=0; i < ehdr.e_shnum; i++)
+        if (shdr[i].sh_type == sh_type &&
+            !ElfN(symtab_valid)(image, size, shdr, ehdr.e_shnum, &shdr[i])) {
+            free(shdr_buf);
+            return -1;
+        }
+
+    /* iterate trough elf sections, several tables are possible */
+    for (unsigned int i=0; i < ehdr.e_shnum; i++) {
+        if (shdr[i].sh_type != sh_type)
+            continue;
+
+        tab.count = shdr[i].sh_size / sizeof(ElfW(Sym));  //get number of symbols
+        tab.info  = shdr[i].sh_info;
+        tab.str   = image + shdr[shdr[i].sh_link].sh_offset;
+        tab.strsz = shdr[shdr[i].sh_link].sh_size;
+        sym_buf = NULL;
+        tab.sym = aligned_view(image + shdr[i].sh_offset, shdr[i].sh_size,
+                               __alignof__(ElfW(Sym)), &sym_buf);
+
+        /* exact search in shared objects: use hash table bound to
+           this symbol table if any, GNU one is preferred; a probe per
+           requested symbol is cheaper than hashing every library symbol
+           for the requested set only while there are fewer of them */
+        if (type && strategy == MATCH_EXACT && symbol.size < tab.count) {
+            hash = NULL;
+            for (unsigned int l=0; l < ehdr.e_shnum && !hash; l++)
+                if (shdr[l].sh_type == SHT_GNU_HASH && shdr[l].sh_link == i)
+                    hash = ElfN(gnu_hash_valid)(image, size, &shdr[l], &tab);
+            if (hash) {
+                ElfN(gnu_lookup)(&tab, hash, filename);
+                free(sym_buf);
+                continue;
+            }
+            for (unsigned int l=0; l < ehdr.e_shnum && !hash; l++)
+                if (shdr[l].sh_type == SHT_HASH && shdr[l].sh_link == i)
+                    hash = ElfN(sysv_hash_valid)(image, size, &shdr[l], &tab);
+            if (hash) {
+                ElfN(sysv_lookup)(&tab, hash, filename);
+                free(sym_buf);
+                continue;
+            }
+        }
+
+        /* regexp search: find literals required by patterns in the
+           whole string table at once, only names containing them are
+           matched; nothing to do if there are none */
+        if (strategy == MATCH_LITERAL) {
+            hit_count = strtab_hits(tab.str, tab.strsz, &hits);
+            if (!hit_count && !opt.verb) {
+                free(sym_buf);
+                continue;
+            }
+        }
+
+        ElfN(walkers)[strategy](&tab, filename, sh_type_str, hits, hit_count);
+        free(hits);
+        hits = NULL;
+        free(sym_buf);
+    }
+
+    free(shdr_buf);
+    return 0;
+}
+
+/* Locate section header table of object file of <type> (see above)
+   in file of <size> bytes, <image> must hold the elf header.
+   Returns 1 if the table is stored to <range>, 0 if there is nothing
+   to read and -1 if the file must be read as a whole. */
+static int ElfN(shdr_range)(const char* const image, const size_t size,
+                            const unsigned int type, struct range_t* const range)
+{
+    ElfW(Ehdr) ehdr;
+
+    if (size < sizeof(ehdr))
+        return -1;
+    ElfN(read_ehdr)(image, &ehdr);
+
+    // wrong type or no section header table: native_readelf() needs nothing
+    if (!type_wanted(ehdr.e_type, type) || (!ehdr.e_shoff && !ehdr.e_shnum))
+        return 0;
+    if (!ehdr.e_shnum || ehdr.e_shentsize != sizeof(ElfW(Shdr)) ||
+        ehdr.e_shoff > size || (size - ehdr.e_shoff) / sizeof(ElfW(Shdr)) < ehdr.e_shnum)
+        return -1;
+
+    range->off = ehdr.e_shoff;
+    range->len = ehdr.e_shnum * sizeof(ElfW(Shdr));
+    return 1;
+}
+
+/* Locate symbol, string and hash tables read by native_readelf(),
+   <image> must hold the elf header and section header table.
+   Returns number of ranges stored to <range> (<max> at most)
+   or -1 if the file must be read as a whole. */
+static int ElfN(table_ranges)(const char* const image, const size_t size,
+                              const unsigned int type, struct range_t* const range,
+                              const unsigned int max)
+{
+    ElfW(Ehdr) ehdr;
+    const ElfW(Shdr) *shdr;
+    void *shdr_buf = NULL;
+    const ElfW(Word) sh_type = (type) ? SHT_DYNSYM : SHT_SYMTAB;
+    const int hashed = type && match_strategy() == MATCH_EXACT;
+    unsigned int count = 0;
+    int whole = 0;
+
+    ElfN(read_ehdr)(image, &ehdr);
+    shdr = ElfN(read_shdr)(image, &ehdr, &shdr_buf);
+
+    for (unsigned int i=0; i < ehdr.e_shnum && !whole; i++) {
+        const ElfW(Shdr) *sec[2] = {&shdr[i], NULL};
+
+        if (shdr[i].sh_type == sh_type) {
+            if (shdr[i].sh_link < ehdr.e_shnum)
+                sec[1] = &shdr[shdr[i].sh_link];
+        }
+        else if (!hashed ||
+                 (shdr[i].sh_type != SHT_GNU_HASH && shdr[i].sh_type != SHT_HASH))
+            continue;
+
+        // broken sections are left to native_readelf() checks
+        for (unsigned int j=0; j < 2 && sec[j]; j++) {
+            if (!ElfN(section_fits)(sec[j], size))
+                continue;
+            if (count == max) {
+                whole = 1;
+                break;
+            }
+            range[count].off = sec[j]->sh_offset;
+            range[count].len = sec[j]->sh_size;
+            count++;
+        }
+    }
+
+    free(shdr_buf);
+    return (whole) ? -1 : (int)count;
+}
+
+#undef ElfW
+#undef ElfW_
+#undef ElfW__
+#undef ElfN
+#undef ElfN_
+#undef ElfN__
+#undef ElfR
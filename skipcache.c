@@ -0,0 +1,203 @@
+/*
+ *  Cache of files known to be neither ELF nor ar
+ *  Copyright © 2007-2011 Andrew Savchenko
+ *
+ *  This file is part of symlookup.
+ *
+ *  symlookup is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 3 as
+ *  published by the Free Software Foundation
+ *
+ *  symlookup is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License version 3 for more details.
+ *
+ *  You should have received a copy of the GNU General Public License version 3
+ *  along with symlookup. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <error.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "symlookup.h"
+#include "safemem.h"
+#include "skipcache.h"
+
+/* Cache file is a header followed by an array of records sorted
+ * by their keys. A record matches a file only if device, inode,
+ * size and modification time are all the same, so replaced or
+ * modified files are never skipped by mistake. Only records
+ * matched or added during the run are saved, so the cache follows
+ * the last scanned trees and doesn't grow forever. */
+
+#define SKIPCACHE_MAGIC "symlookup skip cache 1\n"
+
+/* file key */
+struct skip_t {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t size;
+    int64_t mtime;
+    int64_t mtime_nsec;
+};
+
+static struct {
+    struct skip_t *old;     //loaded records, sorted
+    unsigned char *hit;     //loaded records matched during this run
+    size_t count;           //number of loaded records
+    struct skip_t *new;     //records added during this run
+    size_t new_count;
+    size_t new_alloc;
+} cache;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* make key of file <st> */
+static inline void make_key(const struct stat* const st, struct skip_t* const key)
+{
+    memset(key, 0, sizeof(*key));
+    key->dev = st->st_dev;
+    key->ino = st->st_ino;
+    key->size = st->st_size;
+    key->mtime = st->st_mtim.tv_sec;
+    key->mtime_nsec = st->st_mtim.tv_nsec;
+}
+
+/* comparison function for cache records */
+static int compare_skip(const void* const a, const void* const b)
+{
+    const struct skip_t *const x = a, *const y = b;
+
+    if (x->dev != y->dev)
+        return (x->dev < y->dev) ? -1 : 1;
+    if (x->ino != y->ino)
+        return (x->ino < y->ino) ? -1 : 1;
+    return memcmp(&x->size, &y->size, sizeof(*x) - offsetof(struct skip_t, size));
+}
+
+void skipcache_load()
+{
+    FILE *f;
+    char magic[sizeof(SKIPCACHE_MAGIC) - 1];
+    long len;
+
+    if (!opt.skipcache)
+        return;
+    // no cache yet
+    if (!(f = fopen(opt.skipcache, "r"))) {
+        if (errno != ENOENT && opt.verb)
+            error(0, errno, "warning: can't open skip cache %s", opt.skipcache);
+        return;
+    }
+
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+        memcmp(magic, SKIPCACHE_MAGIC, sizeof(magic)) ||
+        fseek(f, 0, SEEK_END) || (len = ftell(f)) < 0 ||
+        (len -= sizeof(magic)) % sizeof(struct skip_t) ||
+        fseek(f, sizeof(magic), SEEK_SET)) {
+        if (opt.verb)
+            error(0, 0, "warning: skip cache %s is broken, ignoring it", opt.skipcache);
+        fclose(f);
+        return;
+    }
+
+    cache.count = len / sizeof(struct skip_t);
+    if (cache.count) {
+        cache.old = xmalloc(len);
+        cache.hit = xcalloc(cache.count, 1);
+        if (fread(cache.old, sizeof(struct skip_t), cache.count, f) != cache.count) {
+            if (opt.verb)
+                error(0, errno, "warning: can't read skip cache %s", opt.skipcache);
+            cache.count = 0;
+        }
+        // keep bsearch() safe whatever is in the file
+        qsort(cache.old, cache.count, sizeof(struct skip_t), compare_skip);
+    }
+    fclose(f);
+}
+
+int skipcache_known(const struct stat* const st)
+{
+    struct skip_t key;
+    const struct skip_t *rec;
+
+    if (!cache.count)
+        return 0;
+    make_key(st, &key);
+    if (!(rec = bsearch(&key, cache.old, cache.count, sizeof(struct skip_t), compare_skip)))
+        return 0;
+    cache.hit[rec - cache.old] = 1;
+    return 1;
+}
+
+void skipcache_add(const struct stat* const st)
+{
+    if (!opt.skipcache)
+        return;
+
+    pthread_mutex_lock(&cache_lock);
+    if (cache.new_count == cache.new_alloc) {
+        cache.new_alloc = cache.new_alloc ? cache.new_alloc * 2 : 64;
+        cache.new = xrealloc(cache.new, sizeof(struct skip_t) * cache.new_alloc);
+    }
+    make_key(st, &cache.new[cache.new_count++]);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+void skipcache_save()
+{
+    FILE *f;
+    char *tmp;
+    size_t count = 0;
+
+    if (!opt.skipcache)
+        return;
+
+    // keep matched records only and merge new ones in
+    for (size_t i=0; i < cache.count; i++)
+        if (cache.hit[i])
+            cache.old[count++] = cache.old[i];
+    if (cache.new_count) {
+        cache.old = xrealloc(cache.old, sizeof(struct skip_t) * (count + cache.new_count));
+        memcpy(cache.old + count, cache.new, sizeof(struct skip_t) * cache.new_count);
+        count += cache.new_count;
+    }
+    // an empty cache has no records array at all
+    if (count)
+        qsort(cache.old, count, sizeof(struct skip_t), compare_skip);
+
+    // replace cache atomically, parallel runs may use it
+    tmp = xmalloc(strlen(opt.skipcache) + sizeof(".tmp"));
+    strcpy(tmp, opt.skipcache);
+    strcat(tmp, ".tmp");
+    if (!(f = fopen(tmp, "w"))) {
+        if (opt.verb)
+            error(0, errno, "warning: can't write skip cache %s", tmp);
+    }
+    else {
+        int ok = fwrite(SKIPCACHE_MAGIC, 1, sizeof(SKIPCACHE_MAGIC) - 1, f) ==
+                 sizeof(SKIPCACHE_MAGIC) - 1 &&
+                 (!count || fwrite(cache.old, sizeof(struct skip_t), count, f) == count);
+        if (fclose(f))
+            ok = 0;
+        if (!ok || rename(tmp, opt.skipcache)) {
+            if (opt.verb)
+                error(0, errno, "warning: can't write skip cache %s", opt.skipcache);
+            unlink(tmp);
+        }
+    }
+
+    free(tmp);
+    free(cache.old);
+    free(cache.hit);
+    free(cache.new);
+}
@@ -0,0 +1,39 @@
+/*
+ *  Cache of files known to be neither ELF nor ar
+ *  Copyright © 2007-2011 Andrew Savchenko
+ *
+ *  This file is part of symlookup.
+ *
+ *  symlookup is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 3 as
+ *  published by the Free Software Foundation
+ *
+ *  symlookup is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License version 3 for more details.
+ *
+ *  You should have received a copy of the GNU General Public License version 3
+ *  along with symlookup. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SL_SKIPCACHE_H
+#define SL_SKIPCACHE_H
+
+#include <sys/stat.h>
+
+/* load cache from opt.skipcache, if any */
+void skipcache_load();
+
+/* check whether file <st> is known to be neither ELF nor ar
+   1 == skip it
+   0 == file must be checked */
+int skipcache_known(const struct stat* const st);
+
+/* remember that file <st> is neither ELF nor ar */
+void skipcache_add(const struct stat* const st);
+
+/* write cache back to opt.skipcache and free it */
+void skipcache_save();
+
+#endif /* SL_SKIPCACHE_H */
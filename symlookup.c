@@ -29,6 +29,7 @@
 #include <search.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "symlookup.h"
 #include "parser.h"
@@ -37,14 +38,18 @@
 #include "rpmutils.h"
 #include "output.h"
 #include "portageutils.h"
+#include "workers.h"
+#include "uring.h"
+#include "skipcache.h"
+#include "mregex.h"
+#include "index.h"
 
 const size_t reg_error_str_len = 512;
 char *reg_error_str = NULL;
 //flag for found matches in the case of no sort
 unsigned int matches_found = 0;
-
-//use different compare function depend upon case sensitivity
-int (*compare_func) (const char*, const char*) = strcmp;
+//pseudo file of symbols nothing defines (--undefined-of)
+static const char *const str_unresolved = "<unresolved>";
 
 /* structure for string array */
 struct str_t
@@ -66,7 +71,13 @@ struct sym_arr symbol = {
     .match_count = NULL,
     .str    = NULL,
     .regstr = NULL,
-    .match  = NULL
+    .hash   = NULL,
+    .gnu_hash = NULL,
+    .len    = NULL,
+    .set    = NULL,
+    .set_mask = 0,
+    .match  = NULL,
+    .found  = NULL
 };
 
 /* our options, mask flags above are used;
@@ -91,6 +102,10 @@ struct opt_t opt = {
     .verb = V_NORMAL,
     .re   = 0,
     .fts  = FTS_PHYSICAL,
+    .jobs = 1,
+#ifdef HAVE_IO_URING
+    .uring = 0,
+#endif //HAVE_IO_URING
     { /* sort */
         .cnt     = 0,
         .seq     = {0,0
@@ -103,7 +118,13 @@ struct opt_t opt = {
                    },
         .match   = 0
     },
-    .file_re = NULL
+    .file_re = NULL,
+    .skipcache = NULL,
+    .ldcache = NULL,
+    .for_binary = NULL,
+    .undefined_of = NULL,
+    .build_index = NULL,
+    .index = NULL
 };
 /* decrease M_SAVEMEM by a number of types we can save
  * in the best case*/
@@ -121,6 +142,55 @@ struct mtype_t mtype = {
     .file = 1
 };
 
+/* first definition of a symbol in load order (--for-binary) */
+struct bound_t {
+    char *name;
+    char *file;
+};
+
+/* bound definitions, they are stored using balanced binary tree */
+static void *bound_tree = NULL;
+
+/* comparison function for bound definitions tree */
+static int compare_bound(const void* const a, const void* const b)
+{
+    return strcmp(((const struct bound_t*)a)->name, ((const struct bound_t*)b)->name);
+}
+
+/* free memory for bound definitions tree element */
+static void free_bound(void* const leaf)
+{
+    struct bound_t *const bound = leaf;
+    free(bound->name);
+    free(bound->file);
+    free(bound);
+}
+
+/* Check whether ld.so binds symbol <symbolname> to its definition
+   in <filename>: files are scanned in load order, so it is bound to
+   the first file where it is found.
+   Allocated "<symbolname> (bound)" is returned then, NULL otherwise. */
+static char* bound_symbol(const char* const filename, const char* const symbolname)
+{
+    struct bound_t key = {(char*)symbolname, NULL}, **leaf;
+    char *str;
+
+    if ((leaf = tfind(&key, &bound_tree, compare_bound))) {
+        if (strcmp((*leaf)->file, filename))
+            return NULL;
+    }
+    else {
+        struct bound_t *const bound = xmalloc(sizeof(struct bound_t));
+        bound->name = alloc_str(symbolname);
+        bound->file = alloc_str(filename);
+        if (!tsearch(bound, &bound_tree, compare_bound))
+            error(ERR_MEM, errno, "can't allocate memory for bound symbols tree!");
+    }
+    str = xmalloc(strlen(symbolname) + sizeof(" (bound)"));
+    strcpy(stpcpy(str, symbolname), " (bound)");
+    return str;
+}
+
 /* free path array */
 static inline void free_unused()
 {
@@ -143,12 +213,27 @@ static inline void free_unused()
     }
 #endif //HAVE_RPM
     free_str(&sp);
+    tdestroy(bound_tree, free_bound);
+    bound_tree = NULL;
+
+    /* free exact symbol hashes */
+    free(symbol.hash);
+    free(symbol.gnu_hash);
+    free(symbol.len);
+    free(symbol.set);
+    free(opt.skipcache);
+    free(opt.ldcache);
+    free(opt.for_binary);
+    free(opt.undefined_of);
+    free(opt.build_index);
+    free(opt.index);
 
     /* free compiled and error regexp data */
     if (opt.re || opt.file_re)
     {
         free(reg_error_str);
         if (opt.re) {
+            mregex_free();
             for (unsigned int i=0; i < symbol.size; i++)
                 regfree(&symbol.regstr[i]);
             free(symbol.regstr);
@@ -165,6 +250,13 @@ static inline void free_unused()
 void do_match(const unsigned int i, const char* const filename,
                                     const char* const symbolname)
 {
+    //definition bound by ld.so is marked
+    char *const bound = (opt.for_binary && filename != str_unresolved) ?
+                        bound_symbol(filename, symbolname) : NULL;
+
+    if (symbol.found)
+        symbol.found[i] = 1;
+
     //don't sort => print immediately
     if (!opt.sort.cnt)
 #ifdef HAVE_PORTAGE
@@ -175,7 +267,7 @@ void do_match(const unsigned int i, const char* const filename,
     {
 #ifdef HAVE_RPM
         if (opt.rpm) //engage rpm support
-            listrpm(filename, symbolname, NULL);
+            listrpm(filename, (bound) ? bound : symbolname, NULL);
         else
 #endif //HAVE_RPM
         {
@@ -183,9 +275,10 @@ void do_match(const unsigned int i, const char* const filename,
             if (!opt.tbl)
                 putchar(':');
             putchar('\t');
-            puts(symbolname);
+            puts((bound) ? bound : symbolname);
         }
         matches_found = 1;
+        free(bound);
         return;
     }
     /* add new match to match_arr */
@@ -197,7 +290,9 @@ void do_match(const unsigned int i, const char* const filename,
     static char **match;
     match = match_arr.match[match_arr.count];
 
-    if (opt.re || opt.cas)
+    if (bound)
+        match[mtype.symbol] = bound;
+    else if (opt.re || opt.cas)
         match[mtype.symbol] = alloc_str(symbolname);
     else
         // In the case of exact, case insensitive match
@@ -292,61 +387,157 @@ void do_match(const unsigned int i, const char* const filename,
     match_arr.count++;
 }
 
-/* comparison function for uniq_id tree */
-int compare_id(register const void* const a, register const void* const b)
+/* We must ensure that physical files are not duplicate,
+   since fts doesn't do this completely.
+   Unique file id is full device and inode numbers, inode numbers
+   exceed 32 bits on XFS, btrfs etc.
+   Ids are kept in open addressing hash set with linear probing and
+   no per-file allocation. The set is split into shards by the upper
+   bits of the hash, each with its own lock, so walker threads rarely
+   wait for each other; a shard is kept at most half full. */
+#define ID_SHARD_BITS 6
+#define ID_SHARDS (1 << ID_SHARD_BITS)
+
+/* physical file id, {0, 0} stands for empty slot */
+struct file_id_t {
+    uint64_t dev;
+    uint64_t ino;
+};
+
+/* shard of file id set */
+struct id_shard_t {
+    pthread_mutex_t lock;
+    struct file_id_t *slot; //hash table
+    size_t mask;            //number of slots - 1
+    size_t count;           //number of ids stored
+    unsigned int zero;      //id {0, 0} is seen, it can't be stored
+};
+
+static struct id_shard_t id_set[ID_SHARDS] = {
+    [0 ... ID_SHARDS - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER}
+};
+
+/* hash of file id (splitmix64 finalizer) */
+static inline uint64_t id_hash(const struct file_id_t* const id)
 {
-    const unsigned long long x = *(const unsigned long long* const)a;
-    const unsigned long long y = *(const unsigned long long* const)b;
-    return x - y;
+    uint64_t h = id->ino ^ (id->dev * 0x9e3779b97f4a7c15ULL);
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
 }
 
-/* free memory for uniq_id tree element */
-void free_id(register void *const id)
+/* double number of slots of <shard>, 64 slots are allocated at first */
+static void grow_shard(struct id_shard_t* const shard)
 {
-    free(id);
+    const size_t size = (shard->slot) ? (shard->mask + 1) * 2 : 64;
+    struct file_id_t *const slot = xcalloc(size, sizeof(struct file_id_t));
+
+    for (size_t i=0; shard->slot && i <= shard->mask; i++)
+        if (shard->slot[i].dev || shard->slot[i].ino) {
+            size_t j = id_hash(&shard->slot[i]) & (size - 1);
+            while (slot[j].dev || slot[j].ino)
+                j = (j + 1) & (size - 1);
+            slot[j] = shard->slot[i];
+        }
+    free(shard->slot);
+    shard->slot = slot;
+    shard->mask = size - 1;
 }
 
-/* Scan file tree using fts.
+/* check whether physical file <statp> was already seen and remember it
+   1 == seen
+   0 == new file */
+int file_seen(const struct stat* const statp)
+{
+    const struct file_id_t id = {statp->st_dev, statp->st_ino};
+    const uint64_t h = id_hash(&id);
+    struct id_shard_t *const shard = &id_set[h >> (64 - ID_SHARD_BITS)];
+    size_t i;
+    int ret = 1;
+
+    pthread_mutex_lock(&shard->lock);
+    if (!id.dev && !id.ino) {
+        ret = shard->zero;
+        shard->zero = 1;
+    }
+    else {
+        if (!shard->slot || (shard->count + 1) * 2 > shard->mask + 1)
+            grow_shard(shard);
+        for (i = h & shard->mask; shard->slot[i].dev || shard->slot[i].ino;
+             i = (i + 1) & shard->mask)
+            if (shard->slot[i].dev == id.dev && shard->slot[i].ino == id.ino)
+                break;
+        //remember new file, skip already checked one
+        if (!shard->slot[i].dev && !shard->slot[i].ino) {
+            shard->slot[i] = id;
+            shard->count++;
+            ret = 0;
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+    return ret;
+}
 
-   We must ensure that physical files are not duplicate,
-   since fts doesn't do this completely.
-   Unique file id is device_id in the high 32-bit word 
-   and inode_id in the low 32-bit word.
-   So, unique file id is unsigned long long. 
-   They are stored using balanced binary beta-tree */
+/* free file id set */
+static void file_seen_free()
+{
+    for (unsigned int i=0; i < ID_SHARDS; i++) {
+        free(id_set[i].slot);
+        id_set[i].slot = NULL;
+        id_set[i].mask = id_set[i].count = 0;
+        id_set[i].zero = 0;
+    }
+}
+
+/* report broken search path array and exit, <err> is the errno value */
+void search_path_fatal(const int err)
+{
+    error(0,0,"fatal: invalid search path detected");
+    if (opt.dp)
+        error(0,0,"Check your system ld configuration at /etc/ld.so.conf and/or\n"
+                  "$LD_RUN_PATH, $LD_LIBRARY_PATH, $DT_RUNPATH or $DT_RPATH environmental variables.");
+    else
+        error(0,0,"Check search path command line option (-p).");
+
+    error(0,0,"Current search path array:");
+    //the last element is NULL
+    for (int i=0; i < sp.size-1; i++)
+        error(0,0,"path[%i]='%s'",i,sp.str[i]);
+
+    error(ERR_FTS, err, "fatal: cannot initialize file search hierarchy");
+}
+
+/* Scan file tree using fts. */
 static inline void fts_scan()
 {
     FTS *ftsp;      //pointer to fts directory hierarchy
     FTSENT *entry;  //fts entry which depict file
+    struct stat st; //status of entry fts didn't stat
+    const struct stat *statp;
+    unsigned int so, ar;
+    // in physical mode fts tells directories by d_type and doesn't
+    // stat other entries (FTS_NSOK), so most of them are rejected
+    // by name without stat
+    const int nostat = opt.fts & FTS_PHYSICAL;
+
+#ifdef HAVE_IO_URING
+    // queued files are opened later from the initial working directory
+    if (opt.uring) {
+        if (uring_start())
+            opt.uring = 0;
+        else
+            opt.fts |= FTS_NOCHDIR;
+    }
+#endif //HAVE_IO_URING
 
     // fts_open return value isn't defined in case of errors,
     // we must check by errno 8-/
     errno=0;
     // create fts hierarchy
-    ftsp = fts_open(sp.str, opt.fts, NULL);
-    if (errno) {
-        //save errno
-        int err = errno;
-        error(0,0,"fatal: invalid search path detected");
-        if (opt.dp)
-            error(0,0,"Check your system ld configuration at /etc/ld.so.conf and/or\n"
-                      "$LD_RUN_PATH, $LD_LIBRARY_PATH, $DT_RUNPATH or $DT_RPATH environmental variables.");
-        else
-            error(0,0,"Check search path command line option (-p).");
-
-        error(0,0,"Current search path array:");
-        //the last element is NULL
-        for (int i=0; i < sp.size-1; i++)
-            error(0,0,"path[%i]='%s'",i,sp.str[i]);
-
-        error(ERR_FTS, err, "fatal: cannot initialize file search hierarchy");
-    }
-    /* binary tree data */
-    void *tree_root = NULL;         // pointer to id tree root pointer
-    unsigned long long *file_id;    // uniq id of physical file
-    struct stat *statp;             // stat structure of file in question
-    void *leaf;                     // leaf in the tree
-    unsigned int need_alloc = 1;    // flag for allocation memory required;
+    ftsp = fts_open(sp.str, (nostat) ? opt.fts | FTS_NOSTAT : opt.fts, NULL);
+    // stale libraries of ld cache are reported as FTS_NS later
+    if (errno && (!ftsp || !opt.ldcache))
+        search_path_fatal(errno);
 
     if (opt.verb >= V_VERBOSE)
         puts("--> Iterating search tree");
@@ -378,29 +569,30 @@ static inline void fts_scan()
                     continue;
                     break;
             }
-        //process only regular files
-        if (entry->fts_info == FTS_F)
-        {
-            //create unique id
-            statp = entry->fts_statp;
-            //allocate memory only if previous id was put in the tree
-            if (need_alloc)
-                file_id = xmalloc(sizeof(unsigned long long));
-            *file_id = (unsigned long long)(statp->st_dev) << 32 | statp->st_ino;
-
-            //check new file
-            need_alloc=1;
-            if (!(leaf = tsearch(file_id, &tree_root, compare_id))) {
+        if (entry->fts_info == FTS_NSOK && !file_wanted(entry->fts_name, &so, &ar))
+            continue;
+        // status of files given in search path isn't kept with FTS_NOSTAT
+        if (entry->fts_info == FTS_NSOK || (entry->fts_info == FTS_F && nostat)) {
+            if ((entry->fts_info == FTS_NSOK) ? lstat(entry->fts_accpath, &st) :
+                                                stat(entry->fts_accpath, &st)) {
                 if (opt.verb)
-                    error(0,errno,"error: not enough memory for file id tree, "
-                                  "search results may be duplicated");
-                need_alloc=0;
-            } else
-            //skip already checked file
-            if (*(unsigned long long**)leaf != file_id) {
-                need_alloc=0;
+                    error(0,errno,"warning: cannot stat file '%s'", entry->fts_path);
                 continue;
             }
+            statp = &st;
+        }
+        else if (entry->fts_info == FTS_F)
+            statp = entry->fts_statp;
+        else
+            continue;
+        //process only regular files, skip already checked ones
+        if (S_ISREG(statp->st_mode) && !file_seen(statp) && !skipcache_known(statp) &&
+            !index_known(statp, entry->fts_path)) {
+#ifdef HAVE_IO_URING
+            if (opt.uring)
+                uring_add(entry->fts_path, entry->fts_name, statp);
+            else
+#endif //HAVE_IO_URING
             checkfile(entry->fts_accpath, entry->fts_path, entry->fts_name);
         }
     }
@@ -408,17 +600,37 @@ static inline void fts_scan()
     if (errno && opt.verb)
         error(0, errno, "warning: fts hierarchy scan was ended abnormally,\n"
                         "search results may be incomplete");
-    //free field_id pointer if it isn't in the tree
-    if (!need_alloc)
-        free(file_id);
-    //free search tree
-    tdestroy(tree_root, free_id);
+#ifdef HAVE_IO_URING
+    if (opt.uring)
+        uring_finish();
+#endif //HAVE_IO_URING
 
     if (fts_close(ftsp) == -1 && opt.verb)
         error(0, errno, "warning: can't close fts file hierarchy stream\n"
                         "and restore working directory");
 }
 
+/* report symbols of --undefined-of nothing defines as matched
+   in pseudo file str_unresolved */
+static void report_unresolved()
+{
+    for (unsigned int i=0; i < symbol.size; i++)
+        if (!symbol.found[i])
+            do_match(i, str_unresolved, symbol.str[i]);
+    free(symbol.found);
+    symbol.found = NULL;
+}
+
+/* check whether files are read via io_uring */
+static inline int use_uring()
+{
+#ifdef HAVE_IO_URING
+    return opt.uring;
+#else
+    return 0;
+#endif //HAVE_IO_URING
+}
+
 int main(const int argc, char *const argv[])
 {
     /* parse args & preinit some vars */
@@ -429,6 +641,8 @@ int main(const int argc, char *const argv[])
         symbol.match = xcalloc (symbol.size, sizeof(char****));
         symbol.match_count = xcalloc (symbol.size, sizeof(int));
     }
+    if (opt.undefined_of)
+        symbol.found = xcalloc(symbol.size, sizeof(unsigned char));
 
     /* init libelf */
     if (elf_version(EV_CURRENT) == EV_NONE)
@@ -437,8 +651,31 @@ int main(const int argc, char *const argv[])
     /* prepare output */
     init_output();
 
-    /* scan file hierarchy */
-    fts_scan();
+    /* scan file hierarchy or look symbols up in the index;
+       a file of --undefined-of may leave nothing to look for */
+    if (opt.undefined_of && !symbol.size) {
+        if (opt.verb >= V_VERBOSE)
+            puts("--> No undefined symbols to look up");
+    }
+    else if (opt.index)
+        index_query();
+    else {
+        skipcache_load();
+        if (opt.build_index)
+            index_load();
+        // directory listings of index are recorded by workers only
+        if (opt.jobs > 1 || (opt.build_index && !use_uring()))
+            workers_scan();
+        else
+            fts_scan();
+        //free search tree
+        file_seen_free();
+        skipcache_save();
+        if (opt.build_index)
+            index_save();
+    }
+    if (opt.undefined_of)
+        report_unresolved();
 
     /* free unneeded memory */
     free_unused();
@@ -458,7 +695,7 @@ int main(const int argc, char *const argv[])
         ebuild_unsorted_output();
 #endif //HAVE_PORTAGE
     else
-    if (opt.verb && !matches_found)
+    if (opt.verb && !matches_found && !opt.build_index)
         puts(str_not_found);
 
 #ifdef HAVE_RPM
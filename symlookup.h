@@ -21,6 +21,7 @@
 #define SL_SYMBOL_LOOKUP_H
 
 #include <regex.h>
+#include <stdint.h>
 
 //define error codes (0=normal exit, obvious, not defined)
 #define ERR_PARSE 1
@@ -32,9 +33,6 @@
 extern const size_t reg_error_str_len;
 extern char *reg_error_str;
 
-//use different compare function depend upon case sensetivity
-extern int (*compare_func) (const char*, const char*);
-
 /* structure for string array */
 struct str_t {
     unsigned int size; //number of elements
@@ -79,7 +77,13 @@ struct sym_arr {
     unsigned int *match_count;  //number of matches for each symbol
     char **str;                 //user-provided symbols or regexps
     regex_t *regstr;            //regexps for symbols
+    uint32_t *hash;             //SysV ELF hashes for exact match
+    uint32_t *gnu_hash;         //GNU ELF hashes (case folded if -i) for exact match
+    size_t *len;                //lengths of symbols for exact match
+    unsigned int *set;          //hash set of exact symbols (index + 1, 0 == empty)
+    unsigned int set_mask;      //hash set size - 1
     char ****match;             //matched symbols array
+    unsigned char *found;       //symbol is matched (--undefined-of)
 };
 extern struct sym_arr symbol;
 
@@ -110,6 +114,7 @@ struct opt_t {
     unsigned int dp;    // default search path flag
     unsigned int ext;   // perform extensions check for lib files
     unsigned int cas;   // ignore case in symbols
+    unsigned int glob;  // symbols are shell wildcard patterns
     unsigned int tbl;   // use table for results output
     unsigned int hdr;   // print header for the table
 #ifdef HAVE_RPM
@@ -123,8 +128,19 @@ struct opt_t {
     enum verbose_t verb;// verbosity level
     int re;             // regexp options flag (extended regexps)
     int fts;            // fts() options
+    unsigned int jobs;  // number of scan threads
+#ifdef HAVE_IO_URING
+    unsigned int uring; // read files via io_uring
+#endif //HAVE_IO_URING
     struct sort_t sort; // sort params
     regex_t *file_re;   // library file name regular expression 
+    char *skipcache;    // cache of files which are neither ELF nor ar
+    char *ldcache;      // scan libraries listed in this ld.so.cache
+    char *for_binary;   // scan libraries this binary is linked with
+    char *undefined_of; // look up undefined symbols of this file
+    char *build_index;  // write all symbols found to this index
+    char *index;        // answer queries from this index
+    unsigned int consumers; // report files referencing symbols (with index)
 };
 extern struct opt_t opt;
 
@@ -132,4 +148,13 @@ extern struct opt_t opt;
 void do_match(const unsigned int i, const char* const filename,
                                     const char* const symbolname);
 
+/* check whether physical file <statp> was already seen and remember it
+   1 == seen
+   0 == new file */
+struct stat;
+int file_seen(const struct stat* const statp);
+
+/* report broken search path array and exit, <err> is the errno value */
+void search_path_fatal(const int err);
+
 #endif /* SL_SYMBOL_LOOKUP_H */
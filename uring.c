@@ -0,0 +1,431 @@
+/*
+ *  Batched file reading via io_uring
+ *  Copyright © 2007-2011 Andrew Savchenko
+ *
+ *  This file is part of symlookup.
+ *
+ *  symlookup is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 3 as
+ *  published by the Free Software Foundation
+ *
+ *  symlookup is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License version 3 for more details.
+ *
+ *  You should have received a copy of the GNU General Public License version 3
+ *  along with symlookup. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_IO_URING
+
+#include <stdlib.h>
+#include <errno.h>
+#include <error.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <ar.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "symlookup.h"
+#include "safemem.h"
+#include "scanelf.h"
+#include "uring.h"
+#include "skipcache.h"
+
+/* Shared objects are read in three rounds of requests: the first page,
+ * then the section header table (unless the first page holds it) and
+ * finally symbol, string and hash tables. Data is read at its file
+ * offsets into an anonymous mapping of the file size, so only pages
+ * actually read are allocated and the image can be passed to the usual
+ * ELF parser. Opens and reads of up to URING_FILES files are kept in
+ * flight at once, so the disk (or network) latency is overlapped.
+ *
+ * Anything unusual (archives, foreign byte order, short reads, old
+ * kernels without IORING_OP_OPENAT) is passed to synchronous checkfile(). */
+
+#define URING_FILES     64      //files in flight
+#define URING_ENTRIES   256     //submission queue size
+#define URING_RANGES    16      //table reads per file
+#define URING_HEAD      4096    //size of the first read
+
+enum ustate_t {
+    U_FREE,     //slot is unused
+    U_OPEN,     //file is being opened
+    U_HEAD,     //first page is being read
+    U_SHDR,     //section header table is being read
+    U_TABLES    //symbol tables are being read
+};
+
+/* file in flight */
+struct ufile_t {
+    enum ustate_t state;
+    char *path;             //file path
+    size_t name;            //offset of the last path component
+    unsigned int so, ar;    //file type as given by file_wanted()
+    int fd;
+    char *image;            //sparse file image
+    size_t size;            //file size
+    struct stat st;         //file status for skip cache and index
+    size_t head;            //bytes read by the first request
+    unsigned int reads;     //reads in flight
+    unsigned int failed;    //some read was short
+};
+
+/* submission and completion rings */
+static struct {
+    int fd;
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array, sq_entries;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqe_size;
+    unsigned int queued;    //requests not submitted yet
+    unsigned int inflight;  //files in flight
+} ring = {.fd = -1};
+
+static struct ufile_t file[URING_FILES];
+
+/* submit queued requests and wait for <wait> completions */
+static void ring_enter(const unsigned int wait)
+{
+    int ret;
+
+    do
+        ret = syscall(__NR_io_uring_enter, ring.fd, ring.queued, wait,
+                      (wait) ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    while (ret == -1 && errno == EINTR);
+
+    if (ret >= 0)
+        ring.queued -= ret;
+    // busy completion queue is drained by the caller
+    else if (errno != EAGAIN && errno != EBUSY)
+        error(ERR_IO, errno, "fatal: io_uring request submission failed");
+}
+
+/* get clean submission queue entry for request of file <i>, <len> is
+   the expected result of the request */
+static struct io_uring_sqe* get_sqe(const unsigned int i, const size_t len)
+{
+    unsigned int tail = *ring.sq_tail;
+    struct io_uring_sqe *sqe;
+
+    while (tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) == ring.sq_entries)
+        ring_enter(0);
+
+    sqe = &ring.sqe[tail & *ring.sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = (uint64_t)len << 16 | i;
+    ring.sq_array[tail & *ring.sq_mask] = tail & *ring.sq_mask;
+    __atomic_store_n(ring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring.queued++;
+    return sqe;
+}
+
+/* queue read of <len> bytes at <off> of file <i> into its image */
+static void queue_read(const unsigned int i, const size_t off, const size_t len)
+{
+    struct io_uring_sqe *const sqe = get_sqe(i, len);
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = file[i].fd;
+    sqe->addr = (uintptr_t)(file[i].image + off);
+    sqe->len = len;
+    sqe->off = off;
+    file[i].reads++;
+}
+
+/* free slot of file <i> */
+static void release(const unsigned int i)
+{
+    struct ufile_t *const f = &file[i];
+
+    if (f->fd != -1 && close(f->fd) == -1 && opt.verb)
+        error(0, errno, "error: can't close file %s; "
+                        "subsequent processing may be unreliable", f->path);
+    munmap(f->image, f->size);
+    free(f->path);
+    f->state = U_FREE;
+    ring.inflight--;
+}
+
+/* scan file <i> synchronously */
+static void fallback(const unsigned int i)
+{
+    char *const path = alloc_str(file[i].path);
+    const size_t name = file[i].name;
+
+    release(i);
+    checkfile(path, path, path + name);
+    free(path);
+}
+
+/* scan file <i> with its tables read, from a full mapping if they are not enough */
+static void scan_tables(const unsigned int i)
+{
+    struct ufile_t *const f = &file[i];
+
+    if (scanimage(f->image, f->size, f->path, &f->st, f->so, f->ar, 1) < 0)
+        fallback(i);
+    else
+        release(i);
+}
+
+/* report file <i> of unwanted type and free its slot */
+static void skip_file(const unsigned int i)
+{
+    not_wanted(file[i].path, file[i].so, file[i].ar);
+    release(i);
+}
+
+/* queue table reads of file <i> with section header table in place */
+static void read_tables(const unsigned int i)
+{
+    struct ufile_t *const f = &file[i];
+    struct range_t range[URING_RANGES];
+    int count;
+
+    if ((count = elf_table_ranges(f->image, f->size, range, URING_RANGES)) < 0) {
+        fallback(i);
+        return;
+    }
+    // a single read is limited to 2 GB by the kernel
+    for (int j=0; j < count; j++)
+        if (range[j].len > 0x7ffff000) {
+            fallback(i);
+            return;
+        }
+    f->state = U_TABLES;
+    for (int j=0; j < count; j++)
+        if (range[j].off + range[j].len > f->head)
+            queue_read(i, range[j].off, range[j].len);
+
+    if (!f->reads)
+        scan_tables(i);
+}
+
+/* handle completion <res> of request of file <i> expected to return <len> */
+static void complete(const unsigned int i, const int res, const size_t len)
+{
+    struct ufile_t *const f = &file[i];
+    struct range_t shdr;
+    int ret;
+
+    switch (f->state) {
+        case U_OPEN:
+            // kernels before 5.6 can't open files via io_uring
+            if (res == -EINVAL || res == -EOPNOTSUPP) {
+                fallback(i);
+                break;
+            }
+            if (res < 0) {
+                if (opt.verb >= V_VERBOSE)
+                    error(0, -res, "warning: can't open file %s for reading", f->path);
+                release(i);
+                break;
+            }
+            f->fd = res;
+            // only the tables are read, read-ahead would pull in the rest
+            posix_fadvise(f->fd, 0, 0, POSIX_FADV_RANDOM);
+            f->state = U_HEAD;
+            queue_read(i, 0, f->head);
+            break;
+
+        case U_HEAD:
+            f->reads--;
+            if (res < 0 || (size_t)res != len) {
+                fallback(i);
+                break;
+            }
+            if (f->size >= SARMAG && !memcmp(f->image, ARMAG, SARMAG)) {
+                if (f->ar)
+                    fallback(i);
+                else
+                    skip_file(i);
+                break;
+            }
+            if (f->size < SELFMAG || memcmp(f->image, ELFMAG, SELFMAG)) {
+                skipcache_add(&f->st);
+                skip_file(i);
+                break;
+            }
+            if ((ret = elf_shdr_range(f->image, f->size, &shdr)) < 0)
+                fallback(i);
+            else if (!ret)
+                scan_tables(i);
+            else if (shdr.off + shdr.len > f->head) {
+                f->state = U_SHDR;
+                queue_read(i, shdr.off, shdr.len);
+            }
+            else
+                read_tables(i);
+            break;
+
+        case U_SHDR:
+            f->reads--;
+            if (res < 0 || (size_t)res != len)
+                fallback(i);
+            else
+                read_tables(i);
+            break;
+
+        case U_TABLES:
+            f->reads--;
+            if (res < 0 || (size_t)res != len)
+                f->failed = 1;
+            if (f->reads)
+                break;
+            if (f->failed)
+                fallback(i);
+            else
+                scan_tables(i);
+            break;
+
+        case U_FREE:
+            break;
+    }
+}
+
+/* submit queued requests and handle completions, wait for
+   at least one of them if <wait> != 0 */
+static void reap(const unsigned int wait)
+{
+    unsigned int head, tail;
+
+    if (ring.queued || wait)
+        ring_enter(wait);
+
+    head = *ring.cq_head;
+    tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        const struct io_uring_cqe cqe = ring.cqe[head & *ring.cq_mask];
+        // free completion entry before new requests are made
+        __atomic_store_n(ring.cq_head, head + 1, __ATOMIC_RELEASE);
+        complete(cqe.user_data & 0xffff, cqe.res, cqe.user_data >> 16);
+    }
+}
+
+int uring_start()
+{
+    struct io_uring_params p;
+
+    // completion queue must hold all requests in flight
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = URING_FILES * URING_RANGES;
+    if ((ring.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) == -1 && errno == EINVAL) {
+        // kernels before 5.5, default size is twice the submission queue
+        memset(&p, 0, sizeof(p));
+        ring.fd = syscall(__NR_io_uring_setup, URING_FILES * URING_RANGES / 2, &p);
+    }
+    if (ring.fd == -1) {
+        if (opt.verb)
+            error(0, errno, "warning: io_uring is unavailable, using synchronous I/O");
+        return -1;
+    }
+
+    ring.sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring.cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring.sqe_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP && ring.cq_ring_size > ring.sq_ring_size)
+        ring.sq_ring_size = ring.cq_ring_size;
+
+    ring.sq_ring = mmap(NULL, ring.sq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    ring.cq_ring = (p.features & IORING_FEAT_SINGLE_MMAP) ? ring.sq_ring :
+                   mmap(NULL, ring.cq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING);
+    ring.sqe = mmap(NULL, ring.sqe_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.sq_ring == MAP_FAILED || ring.cq_ring == MAP_FAILED || ring.sqe == MAP_FAILED) {
+        if (opt.verb)
+            error(0, errno, "warning: can't map io_uring, using synchronous I/O");
+        if (ring.sqe != MAP_FAILED)
+            munmap(ring.sqe, ring.sqe_size);
+        if (ring.cq_ring != MAP_FAILED && ring.cq_ring != ring.sq_ring)
+            munmap(ring.cq_ring, ring.cq_ring_size);
+        if (ring.sq_ring != MAP_FAILED)
+            munmap(ring.sq_ring, ring.sq_ring_size);
+        close(ring.fd);
+        ring.fd = -1;
+        return -1;
+    }
+
+    ring.sq_head    = (unsigned int*)((char*)ring.sq_ring + p.sq_off.head);
+    ring.sq_tail    = (unsigned int*)((char*)ring.sq_ring + p.sq_off.tail);
+    ring.sq_mask    = (unsigned int*)((char*)ring.sq_ring + p.sq_off.ring_mask);
+    ring.sq_array   = (unsigned int*)((char*)ring.sq_ring + p.sq_off.array);
+    ring.sq_entries = p.sq_entries;
+    ring.cq_head    = (unsigned int*)((char*)ring.cq_ring + p.cq_off.head);
+    ring.cq_tail    = (unsigned int*)((char*)ring.cq_ring + p.cq_off.tail);
+    ring.cq_mask    = (unsigned int*)((char*)ring.cq_ring + p.cq_off.ring_mask);
+    ring.cqe        = (struct io_uring_cqe*)((char*)ring.cq_ring + p.cq_off.cqes);
+    return 0;
+}
+
+void uring_add(const char* const path, const char* const name, const struct stat* const st)
+{
+    const size_t size = st->st_size;
+    unsigned int so, ar, i;
+    struct io_uring_sqe *sqe;
+    char *image;
+
+    if (!file_wanted(name, &so, &ar))
+        return;
+
+    // archives are mapped as a whole, empty files are reported as usual
+    if (!so || !size ||
+        (image = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)) == MAP_FAILED) {
+        checkfile(path, path, name);
+        return;
+    }
+
+    while (ring.inflight == URING_FILES)
+        reap(1);
+    for (i = 0; file[i].state != U_FREE; i++);
+
+    file[i].path = alloc_str(path);
+    file[i].name = strlen(path) - strlen(name);
+    file[i].so = so;
+    file[i].ar = ar;
+    file[i].fd = -1;
+    file[i].image = image;
+    file[i].size = size;
+    file[i].st = *st;
+    file[i].head = (size < URING_HEAD) ? size : URING_HEAD;
+    file[i].reads = 0;
+    file[i].failed = 0;
+    file[i].state = U_OPEN;
+    ring.inflight++;
+
+    sqe = get_sqe(i, 0);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t)file[i].path;
+    sqe->open_flags = O_RDONLY;
+
+    // submit at once, but don't wait for anything yet
+    reap(0);
+}
+
+void uring_finish()
+{
+    while (ring.inflight)
+        reap(1);
+
+    munmap(ring.sqe, ring.sqe_size);
+    if (ring.cq_ring != ring.sq_ring)
+        munmap(ring.cq_ring, ring.cq_ring_size);
+    munmap(ring.sq_ring, ring.sq_ring_size);
+    close(ring.fd);
+    ring.fd = -1;
+}
+
+#endif //HAVE_IO_URING
@@ -0,0 +1,40 @@
+/*
+ *  Batched file reading via io_uring
+ *  Copyright © 2007-2011 Andrew Savchenko
+ *
+ *  This file is part of symlookup.
+ *
+ *  symlookup is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 3 as
+ *  published by the Free Software Foundation
+ *
+ *  symlookup is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License version 3 for more details.
+ *
+ *  You should have received a copy of the GNU General Public License version 3
+ *  along with symlookup. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SL_URING_H
+#define SL_URING_H
+#ifdef HAVE_IO_URING
+
+#include <sys/stat.h>
+
+/* set up io_uring
+   0 == ok
+  -1 == io_uring is unavailable, synchronous I/O must be used */
+int uring_start();
+
+/* queue file <st> for scanning, <path> must be accessible from
+ * the initial working directory, <name> is its last component;
+ * all are copied */
+void uring_add(const char* const path, const char* const name, const struct stat* const st);
+
+/* wait until all queued files are scanned and release io_uring */
+void uring_finish();
+
+#endif //HAVE_IO_URING
+#endif /* SL_URING_H */
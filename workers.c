@@ -0,0 +1,606 @@
+/*
+ *  Parallel file tree traversal and scanning
+ *  Copyright © 2007-2011 Andrew Savchenko
+ *
+ *  This file is part of symlookup.
+ *
+ *  symlookup is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 3 as
+ *  published by the Free Software Foundation
+ *
+ *  symlookup is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License version 3 for more details.
+ *
+ *  You should have received a copy of the GNU General Public License version 3
+ *  along with symlookup. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <error.h>
+#include <string.h>
+#include <fts.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "symlookup.h"
+#include "safemem.h"
+#include "scanelf.h"
+#include "workers.h"
+#include "skipcache.h"
+#include "index.h"
+
+/* Directories and files are tasks kept in per-worker deques.
+ * A worker takes the newest task of its own deque (depth-first, so
+ * the tree is walked with good locality) and, when it runs dry,
+ * steals the oldest task of another worker, which is usually a large
+ * unexplored subtree. Reading a directory only pushes new tasks, so
+ * slow directories (e.g. on NFS) of different search paths or
+ * subtrees are read concurrently.
+ *
+ * fts semantics are kept: opt.fts selects stat(2) or lstat(2)
+ * (FTS_LOGICAL/FTS_PHYSICAL), FTS_XDEV stops at mount points and cycles
+ * are detected via the chain of ancestor directories.
+ *
+ * Regular files aren't scanned while the tree is walked, they are
+ * collected with their position in fts order (search path number and
+ * entry numbers of directories down to the file). A physical file may
+ * be reached by several pathes (hardlinks, symbolic links, overlapping
+ * search pathes), so once the walk is done only the first of them in fts
+ * order is kept and the files are scanned by the workers in the second
+ * pass. Which path is reported thus doesn't depend on thread timing and
+ * is the one serial fts_scan() reports.
+ *
+ * Directory entry type (d_type) tells directories from other entries,
+ * so regular files are selected by name before they are stat'ed, and
+ * ones of other types (symbolic links in physical mode too) are not
+ * stat'ed at all. Entries are stat'ed relative to the open directory.
+ *
+ * When an index is built, listings of directories are recorded to it,
+ * and directories found unchanged on refresh are not read again.
+ *
+ * Each worker scans whole files with its own ELF state and collects
+ * matches locally. Matches of a file are merged into the global
+ * match arrays (or printed) at once under merge_lock, so do_match()
+ * and package queries are never run concurrently and matches of
+ * a single file are never interleaved with other ones. */
+
+extern struct str_t sp; //all search pathes (string array)
+
+/* physical directory id */
+struct dir_id_t {
+    dev_t dev;
+    ino_t ino;
+    unsigned int pos;       //entry number in parent directory (search path number)
+};
+
+/* directory or regular file to process */
+struct task_t {
+    char *path;             //file path
+    size_t name;            //offset of the last path component
+    dev_t root_dev;         //device of the search path (FTS_XDEV)
+    struct dir_id_t *anc;   //directory and its ancestors (directories only)
+    unsigned int depth;     //number of anc elements, 0 for files
+    struct timespec mtime;  //modification time (directories only)
+};
+
+/* per-worker task deque: owner works at the tail, thieves at the head */
+struct deque_t {
+    pthread_mutex_t lock;
+    struct task_t *task;
+    unsigned int size;      //allocated
+    unsigned int head;      //the oldest task
+    unsigned int tail;      //past the newest task
+};
+
+/* regular file found by the walk */
+struct file_t {
+    char *path;             //file path
+    size_t name;            //offset of the last path component
+    struct stat st;
+    unsigned int *key;      //position in fts order: search path and entry numbers
+    unsigned int klen;      //number of key elements
+};
+
+static struct deque_t *deque;   //deques of all workers
+static unsigned int workers;    //number of workers
+
+static unsigned int pending;    //tasks pushed but not finished yet
+static unsigned int sleeping;   //workers waiting for new tasks
+static pthread_mutex_t idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+
+static pthread_mutex_t merge_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct file_t *file;     //regular files found by the walk
+static size_t files;            //number of them
+static size_t files_alloc;      //allocated
+static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* add task to the deque of worker <w> */
+static void push_task(const unsigned int w, const struct task_t* const task)
+{
+    struct deque_t *const q = &deque[w];
+
+    __atomic_add_fetch(&pending, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&q->lock);
+    if (q->tail == q->size) {
+        if (q->head) {
+            memmove(q->task, q->task + q->head, sizeof(struct task_t) * (q->tail - q->head));
+            q->tail -= q->head;
+            q->head = 0;
+        } else {
+            q->size = q->size ? q->size * 2 : 64;
+            q->task = xrealloc(q->task, sizeof(struct task_t) * q->size);
+        }
+    }
+    q->task[q->tail++] = *task;
+    pthread_mutex_unlock(&q->lock);
+
+    // wake up idle worker to steal it
+    if (__atomic_load_n(&sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&idle_lock);
+        pthread_cond_signal(&idle_cond);
+        pthread_mutex_unlock(&idle_lock);
+    }
+}
+
+/* take the newest (<own> != 0) or the oldest task of worker <w>
+   1 == got it
+   0 == deque is empty */
+static int take_task(const unsigned int w, const int own, struct task_t* const task)
+{
+    struct deque_t *const q = &deque[w];
+    int ret = 0;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->head != q->tail) {
+        *task = own ? q->task[--q->tail] : q->task[q->head++];
+        if (q->head == q->tail)
+            q->head = q->tail = 0;
+        ret = 1;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return ret;
+}
+
+/* get next task for worker <w>, stealing if own deque is empty
+   1 == got it
+   0 == all tasks are done */
+static int get_task(const unsigned int w, struct task_t* const task)
+{
+    for (;;) {
+        if (take_task(w, 1, task))
+            return 1;
+        for (unsigned int i = 1; i < workers; i++)
+            if (take_task((w + i) % workers, 0, task))
+                return 1;
+
+        pthread_mutex_lock(&idle_lock);
+        if (!__atomic_load_n(&pending, __ATOMIC_SEQ_CST)) {
+            pthread_mutex_unlock(&idle_lock);
+            return 0;
+        }
+        // new tasks are signalled, timeout only covers a racing push
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 10000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        __atomic_add_fetch(&sleeping, 1, __ATOMIC_SEQ_CST);
+        pthread_cond_timedwait(&idle_cond, &idle_lock, &ts);
+        __atomic_sub_fetch(&sleeping, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&idle_lock);
+    }
+}
+
+/* mark task as finished, wake everybody up when the last one is done */
+static void finish_task()
+{
+    if (!__atomic_sub_fetch(&pending, 1, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&idle_lock);
+        pthread_cond_broadcast(&idle_cond);
+        pthread_mutex_unlock(&idle_lock);
+    }
+}
+
+/* stat file <path> relative to directory <dfd> (or AT_FDCWD)
+   according to opt.fts
+   0 == ok, FTS_NS or FTS_SLNONE otherwise (errno is preserved) */
+static int stat_file(const int dfd, const char* const path, struct stat* const st)
+{
+    if (opt.fts & FTS_LOGICAL) {
+        if (!fstatat(dfd, path, st, 0))
+            return 0;
+        const int err = errno;
+        if (!fstatat(dfd, path, st, AT_SYMLINK_NOFOLLOW) && S_ISLNK(st->st_mode))
+            return FTS_SLNONE;
+        errno = err;
+        return FTS_NS;
+    }
+    return fstatat(dfd, path, st, AT_SYMLINK_NOFOLLOW) ? FTS_NS : 0;
+}
+
+/* queue directory <path> with parent task <parent> (NULL for search path)
+   for worker <w>, <path> is taken over; <pos> is its entry number
+   in the parent (search path number) */
+static void push_dir(const unsigned int w, char* const path, const size_t name,
+                     const struct stat* const st, const struct task_t* const parent,
+                     const unsigned int pos)
+{
+    struct task_t task;
+
+    task.path = path;
+    task.name = name;
+    task.root_dev = parent ? parent->root_dev : st->st_dev;
+    task.depth = parent ? parent->depth + 1 : 1;
+    task.anc = xmalloc(sizeof(struct dir_id_t) * task.depth);
+    if (parent)
+        memcpy(task.anc, parent->anc, sizeof(struct dir_id_t) * parent->depth);
+    task.anc[task.depth - 1].dev = st->st_dev;
+    task.anc[task.depth - 1].ino = st->st_ino;
+    task.anc[task.depth - 1].pos = pos;
+    task.mtime = st->st_mtim;
+    push_task(w, &task);
+}
+
+/* queue regular file <path> for worker <w>, <path> is taken over */
+static void push_file(const unsigned int w, char* const path, const size_t name)
+{
+    struct task_t task = {path, name, 0, NULL, 0, {0, 0}};
+    push_task(w, &task);
+}
+
+/* remember regular file <path> with status <st> found at entry <pos>
+   of directory <dir> (search path <pos> if <dir> is NULL),
+   <path> is taken over */
+static void add_file(char* const path, const size_t name, const struct stat* const st,
+                     const struct task_t* const dir, const unsigned int pos)
+{
+    const unsigned int depth = dir ? dir->depth : 0;
+    unsigned int *const key = xmalloc(sizeof(unsigned int) * (depth + 1));
+
+    for (unsigned int i = 0; i < depth; i++)
+        key[i] = dir->anc[i].pos;
+    key[depth] = pos;
+
+    pthread_mutex_lock(&file_lock);
+    if (files == files_alloc) {
+        files_alloc = files_alloc ? files_alloc * 2 : 256;
+        file = xrealloc(file, sizeof(struct file_t) * files_alloc);
+    }
+    file[files].path = path;
+    file[files].name = name;
+    file[files].st = *st;
+    file[files].key = key;
+    file[files].klen = depth + 1;
+    files++;
+    pthread_mutex_unlock(&file_lock);
+}
+
+/* stat entry <path> of directory <dir> and queue it for worker <w>,
+   <path> is taken over, <plen> is offset of its last component
+   and <pos> is its entry number in <dir>;
+   <type> is d_type of the entry, the entry is stat'ed relative to <dfd>
+   (AT_FDCWD for the full path) and recorded to index if <record> is set */
+static void add_entry(const unsigned int w, const struct task_t* const dir,
+                      const int dfd, char* const path, const size_t plen,
+                      const unsigned int pos, const unsigned char type, const int record)
+{
+    struct stat st;
+    unsigned int so, ar;
+    int ret;
+
+    if (type == DT_REG && record)
+        index_dir_add(path + plen, 0);
+    // only directories, regular files of wanted names
+    // and whatever may be behind them are stat'ed
+    if (type != DT_DIR && type != DT_UNKNOWN &&
+        !(type == DT_LNK && (opt.fts & FTS_LOGICAL)) &&
+        (type != DT_REG || !file_wanted(path + plen, &so, &ar))) {
+        free(path);
+        return;
+    }
+
+    if ((ret = stat_file(dfd, (dfd == AT_FDCWD) ? path : path + plen, &st))) {
+        if (opt.verb) {
+            if (ret == FTS_SLNONE)
+                error(0,0,"warning: file '%s' is a stale symbolic link", path);
+            else
+                error(0,errno,"warning: cannot stat file '%s'", path);
+        }
+        free(path);
+        return;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        if (record)
+            index_dir_add(path + plen, 1);
+        // don't cross mount points
+        if ((opt.fts & FTS_XDEV) && st.st_dev != dir->root_dev) {
+            free(path);
+            return;
+        }
+        unsigned int i;
+        for (i = 0; i < dir->depth; i++)
+            if (dir->anc[i].dev == st.st_dev && dir->anc[i].ino == st.st_ino)
+                break;
+        if (i < dir->depth) {
+            if (opt.verb)
+                error(0,0,"warning: directory '%s' causes a cycle in the file system tree",
+                      path);
+            free(path);
+            return;
+        }
+        push_dir(w, path, plen, &st, dir, pos);
+        return;
+    }
+
+    if (S_ISREG(st.st_mode) && record && type != DT_REG)
+        index_dir_add(path + plen, 0);
+    //process only regular files, duplicates are dropped after the walk
+    if (S_ISREG(st.st_mode))
+        add_file(path, plen, &st, dir, pos);
+    else
+        free(path);
+}
+
+/* make path of entry <name> of directory <dir> of <len> bytes,
+   <plen> is offset of the entry name */
+static char* entry_path(const char* const dir, const size_t len, const size_t plen,
+                        const char* const name)
+{
+    char *const path = xmalloc(plen + strlen(name) + 1);
+
+    memcpy(path, dir, len);
+    path[len] = '/';
+    strcpy(path + plen, name);
+    return path;
+}
+
+/* read directory <dir> and queue its entries for worker <w>;
+   unchanged directories of refreshed index are not read at all */
+static void read_dir(const unsigned int w, const struct task_t* const dir)
+{
+    DIR *dp;
+    struct dirent *de;
+    const size_t len = strlen(dir->path);
+    // don't double slash of the root directory
+    const size_t plen = len && dir->path[len - 1] == '/' ? len : len + 1;
+    unsigned int pos = 0;
+
+    if (opt.build_index &&
+        index_dir_open(dir->path, dir->anc[dir->depth - 1].dev,
+                       dir->anc[dir->depth - 1].ino, &dir->mtime)) {
+        const char *name;
+        int is_dir;
+
+        // only subdirectories and new or unknown files are stat'ed
+        while ((name = index_dir_next(&is_dir))) {
+            char *const path = entry_path(dir->path, len, plen, name);
+            if (!is_dir && index_dir_keep(path))
+                free(path);
+            else
+                add_entry(w, dir, AT_FDCWD, path, plen, pos, (is_dir) ? DT_DIR : DT_REG, 0);
+            pos++;
+        }
+        index_dir_close(1);
+        return;
+    }
+
+    if (!(dp = opendir(dir->path))) {
+        if (opt.verb)
+            error(0,errno,"warning: directory '%s' cannot be read", dir->path);
+        if (opt.build_index)
+            index_dir_close(0);
+        return;
+    }
+
+    while ((de = readdir(dp))) {
+        if (de->d_name[0] == '.' && (!de->d_name[1] ||
+           (de->d_name[1] == '.' && !de->d_name[2])))
+            continue;
+        add_entry(w, dir, dirfd(dp), entry_path(dir->path, len, plen, de->d_name), plen,
+                  pos++, de->d_type, opt.build_index != NULL);
+    }
+
+    if (closedir(dp) && opt.verb)
+        error(0,errno,"warning: can't close directory '%s'", dir->path);
+    if (opt.build_index)
+        index_dir_close(1);
+}
+
+/* report matches collected for file <filename> */
+static void merge_found(const struct found_t* const found, const char* const filename)
+{
+    pthread_mutex_lock(&merge_lock);
+    for (unsigned int i=0; i < found->count; i++)
+        do_match(found->idx[i], filename, found->pool + found->sym[i]);
+    pthread_mutex_unlock(&merge_lock);
+}
+
+/* traversal and scan worker thread, <arg> is worker number */
+static void* scan_worker(void* const arg)
+{
+    const unsigned int w = (unsigned int)(size_t)arg;
+    struct found_t found = {0, 0, NULL, NULL, NULL, 0, 0};
+    struct task_t task;
+
+    collect_matches(&found);
+    while (get_task(w, &task)) {
+        if (task.depth) {
+            read_dir(w, &task);
+            free(task.anc);
+        } else {
+            found.count = 0;
+            found.used = 0;
+            checkfile(task.path, task.path, task.path + task.name);
+            if (found.count)
+                merge_found(&found, task.path);
+        }
+        free(task.path);
+        finish_task();
+    }
+    collect_matches(NULL);
+
+    free(found.idx);
+    free(found.sym);
+    free(found.pool);
+    return NULL;
+}
+
+/* queue search path <path> number <pos> for worker <w> */
+static void push_root(const unsigned int w, const char* const path, const unsigned int pos)
+{
+    struct stat st;
+    int ret;
+
+    // command line symlinks are followed only in logical mode
+    // or with FTS_COMFOLLOW as fts does
+    if (opt.fts & FTS_COMFOLLOW)
+        ret = stat(path, &st) ? FTS_NS : 0;
+    else
+        ret = stat_file(AT_FDCWD, path, &st);
+    if (ret) {
+        // fts_open() fails on search path which can't be stat'ed,
+        // but libraries of ld cache may be just stale
+        if (ret == FTS_NS && !opt.ldcache)
+            search_path_fatal(errno);
+        if (opt.verb) {
+            if (ret == FTS_NS)
+                error(0,errno,"warning: cannot stat file '%s'", path);
+            else
+                error(0,0,"warning: file '%s' is a stale symbolic link", path);
+        }
+        return;
+    }
+
+    const char *const slash = strrchr(path, '/');
+    const size_t name = slash && slash[1] ? slash - path + 1 : 0;
+
+    if (S_ISDIR(st.st_mode))
+        push_dir(w, alloc_str(path), name, &st, NULL, pos);
+    else
+    if (S_ISREG(st.st_mode))
+        add_file(alloc_str(path), name, &st, NULL, pos);
+}
+
+/* compare files by fts order */
+static int compare_order(const struct file_t* const x, const struct file_t* const y)
+{
+    for (unsigned int i = 0; i < x->klen && i < y->klen; i++)
+        if (x->key[i] != y->key[i])
+            return (x->key[i] > y->key[i]) - (x->key[i] < y->key[i]);
+    return (x->klen > y->klen) - (x->klen < y->klen);
+}
+
+/* compare files by physical id, then by fts order */
+static int compare_file_id(const void* const a, const void* const b)
+{
+    const struct file_t *const x = a, *const y = b;
+
+    if (x->st.st_dev != y->st.st_dev)
+        return (x->st.st_dev > y->st.st_dev) - (x->st.st_dev < y->st.st_dev);
+    if (x->st.st_ino != y->st.st_ino)
+        return (x->st.st_ino > y->st.st_ino) - (x->st.st_ino < y->st.st_ino);
+    return compare_order(x, y);
+}
+
+static int compare_file_order(const void* const a, const void* const b)
+{
+    return compare_order(a, b);
+}
+
+/* keep the first path of each physical file found by the walk
+   and queue files still to be checked in fts order */
+static void queue_files()
+{
+    size_t count = 0;
+
+    if (files > 1)
+        qsort(file, files, sizeof(struct file_t), compare_file_id);
+    for (size_t i = 0; i < files; i++) {
+        if (count && file[count - 1].st.st_dev == file[i].st.st_dev &&
+            file[count - 1].st.st_ino == file[i].st.st_ino) {
+            free(file[i].path);
+            free(file[i].key);
+        }
+        else
+            file[count++] = file[i];
+    }
+    if (count > 1)
+        qsort(file, count, sizeof(struct file_t), compare_file_order);
+
+    // workers take their newest tasks first, so push in reverse order
+    for (size_t i = count; i-- > 0; ) {
+        struct file_t *const f = &file[i];
+        // files of unchanged directories of index are already seen
+        if (!file_seen(&f->st) && !skipcache_known(&f->st) && !index_known(&f->st, f->path))
+            push_file(i % workers, f->path, f->name);
+        else
+            free(f->path);
+        free(f->key);
+    }
+    free(file);
+    file = NULL;
+    files = files_alloc = 0;
+}
+
+/* run <workers> threads until all queued tasks are done */
+static void run_workers()
+{
+    pthread_t *const worker = xmalloc(sizeof(pthread_t) * workers);
+    unsigned int started;
+    int err;
+
+    for (started = 0; started < workers; started++)
+        if ((err = pthread_create(&worker[started], NULL, scan_worker,
+                                  (void*)(size_t)started))) {
+            if (opt.verb)
+                error(0, err, "warning: can't create scan thread, using %u of %u",
+                      started, workers);
+            break;
+        }
+    // tasks of missing workers are stolen, scan in place if nothing started
+    if (!started)
+        scan_worker((void*)0);
+
+    for (unsigned int i=0; i < started; i++)
+        pthread_join(worker[i], NULL);
+    free(worker);
+}
+
+/* walk search path array and scan found files in opt.jobs threads */
+void workers_scan()
+{
+    workers = opt.jobs;
+    deque = xcalloc(workers, sizeof(struct deque_t));
+    for (unsigned int i=0; i < workers; i++)
+        pthread_mutex_init(&deque[i].lock, NULL);
+
+    // spread search paths between workers, the last element is NULL
+    for (unsigned int i=0; i < sp.size-1; i++)
+        push_root(i % workers, sp.str[i], i);
+
+    if (opt.verb >= V_VERBOSE)
+        puts("--> Iterating search tree");
+
+    // walk the tree, then scan files found
+    run_workers();
+    queue_files();
+    run_workers();
+
+    for (unsigned int i=0; i < workers; i++) {
+        pthread_mutex_destroy(&deque[i].lock);
+        free(deque[i].task);
+    }
+    free(deque);
+}